@@ -24,6 +24,7 @@ class AuthHandler(RequestHandler):
 class TaskHandler(RequestHandler):
 
 	tasks = []
+	next_id = 0
 
 	def get(self):
 
@@ -38,7 +39,9 @@ class TaskHandler(RequestHandler):
 
 		if method == 'create':
 			task = {}
-			task['id'] = len(self.tasks)
+			# ids stay unique once tasks have been deleted
+			task['id'] = TaskHandler.next_id
+			TaskHandler.next_id += 1
 			task['title'] = self.get_argument('uri')
 			task['status'] = 'downloading'
 			task['size'] = 1234
@@ -52,19 +55,49 @@ class TaskHandler(RequestHandler):
 			task['additional'] = { 'transfer': transfer }
 			self.tasks.append(task)
 		elif method == 'delete':
-			id = int(self.get_argument('id'))
-			del(self.tasks[id])
+			ids = self.get_argument('id').split(',')
+			self.tasks[:] = [t for t in self.tasks
+						if str(t['id']) not in ids]
+		elif method in ('pause', 'resume'):
+			status = 'paused' if method == 'pause' else 'downloading'
+			for id in self.get_argument('id').split(','):
+				for task in self.tasks:
+					if str(task['id']) == id:
+						task['status'] = status
 		elif method == 'list':
 			data['tasks'] = self.tasks
 
 		res['data'] = data
 		self.write(json.dumps(res))
 
+class StatisticHandler(RequestHandler):
+
+	def get(self):
+
+		res = {}
+		data = {}
+
+		res['success'] = True
+
+		data['speed_download'] = 0
+		data['speed_upload'] = 0
+
+		for task in TaskHandler.tasks:
+			if task['status'] == 'downloading':
+				transfer = task['additional']['transfer']
+				data['speed_download'] += transfer['speed_download']
+				data['speed_upload'] += transfer['speed_upload']
+
+		res['data'] = data
+		self.write(json.dumps(res))
+
 application = Application([
 	(r"/webapi/auth.cgi", AuthHandler),
 	(r"//webapi/auth.cgi", AuthHandler),
 	(r"/webapi/DownloadStation/task.cgi", TaskHandler),
 	(r"//webapi/DownloadStation/task.cgi", TaskHandler),
+	(r"/webapi/DownloadStation/statistic.cgi", StatisticHandler),
+	(r"//webapi/DownloadStation/statistic.cgi", StatisticHandler),
 ])
 
 if __name__ == "__main__":
@@ -0,0 +1,387 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt.h"
+#include "nas.h"
+#include "poller.h"
+#include "syno.h"
+
+/*
+ * BitTorrent searches run on the NAS: we start one, then keep asking for
+ * the results past those we already have until the server says it is
+ * done. A worker thread does the asking, so results show up while the
+ * user scrolls through the first ones. Recent searches are kept, asking
+ * for one of them again shows it right away.
+ */
+
+#define BT_CACHE 8
+
+/* ms between polls while the server is still searching */
+#define BT_POLL 1000
+
+/* results per list call, see syno_bt_list() */
+#define BT_PAGE 100
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static int running;
+
+static struct bt_query cache[BT_CACHE];
+static struct bt_query *active;
+static int generation;
+
+/* searches dropped from the cache, for the worker to clean up */
+static char orphans[BT_CACHE][64];
+static int norphans;
+
+/* searches run on the first DiskStation */
+static struct session *session;
+static const char *base;
+
+static void
+query_reset(struct bt_query *q)
+{
+	free(q->results);
+	memset(q, 0, sizeof(struct bt_query));
+}
+
+static int
+query_append(struct bt_query *q, struct bt_result *r, int n)
+{
+	struct bt_result *tmp;
+	int cap;
+
+	if (q->n + n > q->cap)
+	{
+		cap = (q->n + n) * 2;
+		tmp = realloc(q->results, cap * sizeof(struct bt_result));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return 1;
+		}
+
+		q->results = tmp;
+		q->cap = cap;
+	}
+
+	memcpy(q->results + q->n, r, n * sizeof(struct bt_result));
+	q->n += n;
+	return 0;
+}
+
+/* the server keeps searches around until told otherwise */
+static void
+clean(const char *taskid)
+{
+	char id[64];
+
+	snprintf(id, sizeof(id), "%s", taskid);
+	syno_set_progress(session, NULL, NULL);
+
+	pthread_mutex_unlock(&lock);
+	syno_bt_clean(base, session, id);
+	pthread_mutex_lock(&lock);
+}
+
+/* a request for a search the user has moved on from is not waited for */
+static int
+abandoned(void *arg, int64_t bytes, double elapsed)
+{
+	int stop;
+
+	pthread_mutex_lock(&lock);
+	stop = arg && (!running || *(int *) arg != generation);
+	pthread_mutex_unlock(&lock);
+
+	return stop;
+}
+
+/* gets the session ready for a request of search generation *gen */
+static int
+prepare(int *gen)
+{
+	if (nas_session(0, &session) != 0)
+	{
+		return 1;
+	}
+
+	syno_set_progress(session, abandoned, gen);
+	return 0;
+}
+
+static void
+wait_poll()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += BT_POLL / 1000;
+	ts.tv_nsec += (BT_POLL % 1000) * 1000000;
+
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_cond_timedwait(&wakeup, &lock, &ts);
+}
+
+/* one request for the active search, with the lock released meanwhile */
+static void
+step(struct bt_query *q)
+{
+	struct bt_result *res;
+	char keyword[128], taskid[64];
+	int gen, n, offset, finished, failed;
+
+	gen = generation;
+	memcpy(keyword, q->keyword, sizeof(keyword));
+	memcpy(taskid, q->taskid, sizeof(taskid));
+	offset = q->n;
+	res = NULL;
+
+	if (!taskid[0])
+	{
+		pthread_mutex_unlock(&lock);
+		failed = prepare(&gen) || syno_bt_start(base,
+				session, keyword, taskid, sizeof(taskid));
+		pthread_mutex_lock(&lock);
+
+		if (gen != generation && !failed)
+		{
+			clean(taskid);
+		}
+		else if (gen == generation)
+		{
+			q->failed = failed;
+			memcpy(q->taskid, taskid, sizeof(taskid));
+		}
+
+		return;
+	}
+
+	pthread_mutex_unlock(&lock);
+	failed = prepare(&gen) || syno_bt_list(base, session,
+				taskid, offset, &res, &n, &finished);
+	pthread_mutex_lock(&lock);
+
+	/* the user has moved on, the search picks up here next time */
+	if (gen != generation)
+	{
+		free(res);
+		return;
+	}
+
+	if (failed || query_append(q, res, n) != 0)
+	{
+		q->failed = 1;
+		free(res);
+		return;
+	}
+
+	free(res);
+
+	/* done once the server is and we have seen all it found */
+	if (finished && n < BT_PAGE)
+	{
+		q->finished = 1;
+		clean(taskid);
+	}
+	else if (n < BT_PAGE)
+	{
+		wait_poll();
+	}
+}
+
+static void *
+work(void *arg)
+{
+	pthread_mutex_lock(&lock);
+
+	while (running)
+	{
+		if (norphans > 0)
+		{
+			norphans -= 1;
+			clean(orphans[norphans]);
+			continue;
+		}
+
+		if (!active || active->finished || active->failed)
+		{
+			pthread_cond_wait(&wakeup, &lock);
+			continue;
+		}
+
+		step(active);
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int
+bt_start()
+{
+	session = NULL;
+	base = nas_url(0);
+	running = 1;
+
+	if (pthread_create(&worker, NULL, work, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to start worker thread\n");
+		running = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+bt_stop()
+{
+	int i;
+
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(worker, NULL);
+
+	if (session)
+	{
+		syno_set_progress(session, NULL, NULL);
+	}
+
+	for (i = 0; i < BT_CACHE; i++)
+	{
+		if (cache[i].taskid[0] && !cache[i].finished)
+		{
+			syno_bt_clean(base, session, cache[i].taskid);
+		}
+
+		query_reset(&cache[i]);
+	}
+
+	while (norphans > 0)
+	{
+		syno_bt_clean(base, session, orphans[--norphans]);
+	}
+
+	active = NULL;
+
+	/* not logged out, the session belongs to the NAS thread */
+	syno_free(session);
+	session = NULL;
+}
+
+/* makes keyword the active search, starting it unless we have it */
+void
+bt_search(const char *keyword)
+{
+	struct bt_query *q;
+	int i;
+
+	pthread_mutex_lock(&lock);
+
+	q = NULL;
+
+	for (i = 0; i < BT_CACHE && !q; i++)
+	{
+		if (!strcmp(cache[i].keyword, keyword))
+		{
+			q = &cache[i];
+		}
+	}
+
+	if (!q)
+	{
+		q = &cache[0];
+
+		for (i = 1; i < BT_CACHE; i++)
+		{
+			if (cache[i].used < q->used)
+			{
+				q = &cache[i];
+			}
+		}
+
+		if (q->taskid[0] && !q->finished && norphans < BT_CACHE)
+		{
+			memcpy(orphans[norphans++], q->taskid, sizeof(q->taskid));
+		}
+
+		query_reset(q);
+		snprintf(q->keyword, sizeof(q->keyword), "%s", keyword);
+	}
+	else if (q->failed)
+	{
+		/* try again from scratch */
+		query_reset(q);
+		snprintf(q->keyword, sizeof(q->keyword), "%s", keyword);
+	}
+
+	q->used = now_ms();
+	active = q;
+	generation += 1;
+
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+/* stops polling for the active search */
+void
+bt_idle()
+{
+	pthread_mutex_lock(&lock);
+	active = NULL;
+	generation += 1;
+	pthread_mutex_unlock(&lock);
+}
+
+/* the active search, locked until bt_unlock() */
+struct bt_query *
+bt_lock()
+{
+	pthread_mutex_lock(&lock);
+	return active;
+}
+
+void
+bt_unlock()
+{
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,46 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_BT_H
+#define __SYNODL_BT_H
+
+#include "syno.h"
+
+/* a search and the results that have come in so far */
+struct bt_query
+{
+	char keyword[128];
+	char taskid[64];	/* on the server, empty until started */
+	struct bt_result *results;
+	int n;
+	int cap;
+	int finished;
+	int failed;
+	double used;
+};
+
+int bt_start();
+void bt_stop();
+void bt_search(const char *keyword);
+void bt_idle();
+struct bt_query *bt_lock();
+void bt_unlock();
+
+#endif
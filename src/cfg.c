@@ -20,35 +20,434 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <pwd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "cfg.h"
 #include "ini.h"
 
+/* the names of the hook_... settings, and SYNODL_EVENT of the hooks */
+const char *event_names[] = {
+	"added", "status", "finished", "error", "removed"
+};
+
+/*
+ * A schedule line looks like
+ *
+ *   schedule = mon-fri 08:00-18:00 active=2 down=500 up=100
+ *
+ * The days are optional and can also be a list (sat,sun), a window may run
+ * past midnight (22:00-06:00). The first window that matches wins; outside
+ * of all of them synodl goes back to queue_active and no speed limits.
+ */
+
+static const char *day_names[] = {
+	"sun", "mon", "tue", "wed", "thu", "fri", "sat"
+};
+
+static int
+parse_day(const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < 7; i++)
+	{
+		if (len == 3 && !strncasecmp(s, day_names[i], 3))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* "mon-fri" or "sat,sun", as a mask */
+static int
+parse_days(const char *s)
+{
+	int mask, from, to, len;
+
+	mask = 0;
+
+	while (*s)
+	{
+		len = strcspn(s, ",-");
+
+		if ((from = parse_day(s, len)) < 0)
+		{
+			return 0;
+		}
+
+		s += len;
+		to = from;
+
+		if (*s == '-')
+		{
+			len = strcspn(++s, ",");
+
+			if ((to = parse_day(s, len)) < 0)
+			{
+				return 0;
+			}
+
+			s += len;
+		}
+
+		/* mon-fri, but also fri-mon */
+		while (1)
+		{
+			mask |= 1 << from;
+
+			if (from == to)
+				break;
+
+			from = (from + 1) % 7;
+		}
+
+		if (*s == ',')
+		{
+			s++;
+		}
+	}
+
+	return mask;
+}
+
+static int
+parse_time(const char *s, int *min)
+{
+	int h, m;
+	char c;
+
+	if (sscanf(s, "%d:%d%c", &h, &m, &c) != 2 || h < 0 || h > 24 ||
+					m < 0 || m > 59 || (h == 24 && m))
+	{
+		return 1;
+	}
+
+	*min = h * 60 + m;
+	return 0;
+}
+
+static int
+parse_limit(const char *word, const char *key, int *val)
+{
+	size_t len = strlen(key);
+	char *end;
+
+	if (strncmp(word, key, len) || word[len] != '=')
+	{
+		return 0;
+	}
+
+	*val = strtol(word + len + 1, &end, 10);
+	return *end || *val < 0 ? -1 : 1;
+}
+
+/* adds the window a "schedule" line describes, 0 on success */
+static int
+config_schedule(struct schedule *sc, const char *value)
+{
+	struct schedule_window *w;
+	char buf[256], *word, *save, *dash;
+	int res;
+
+	if (sc->n == SCHEDULE_MAX)
+	{
+		fprintf(stderr, "Too many schedule lines in configuration file\n");
+		return 1;
+	}
+
+	w = &sc->w[sc->n];
+	snprintf(w->spec, sizeof(w->spec), "%s", value);
+	snprintf(buf, sizeof(buf), "%s", value);
+
+	w->days = 0x7f;
+	w->start = -1;
+	w->active = -1;
+	w->dn = -1;
+	w->up = -1;
+
+	for (word = strtok_r(buf, " \t", &save); word;
+					word = strtok_r(NULL, " \t", &save))
+	{
+		if ((res = parse_limit(word, "active", &w->active)) ||
+			(res = parse_limit(word, "down", &w->dn)) ||
+			(res = parse_limit(word, "up", &w->up)))
+		{
+			if (res < 0)
+				break;
+		}
+		else if (strchr(word, ':') && (dash = strchr(word, '-')))
+		{
+			*dash = 0;
+
+			if (parse_time(word, &w->start) ||
+						parse_time(dash + 1, &w->end))
+				break;
+		}
+		else if (!(w->days = parse_days(word)))
+		{
+			break;
+		}
+	}
+
+	if (word || w->start < 0)
+	{
+		fprintf(stderr, "Invalid schedule in configuration file: %s\n",
+								value);
+		return 1;
+	}
+
+	sc->n++;
+	return 0;
+}
+
+/* the NAS a section describes, "" being the one at the top of the file */
+static struct cfg_nas *
+config_nas(struct cfg *cf, const char *section)
+{
+	struct cfg_nas *nas;
+	int i;
+
+	for (i = 0; i < cf->nas_count; i++)
+	{
+		if (!strcmp(cf->nas[i].name, section))
+		{
+			return &cf->nas[i];
+		}
+	}
+
+	if (strlen(section) >= sizeof(nas->name))
+	{
+		fprintf(stderr, "Section name too long: %s\n", section);
+		return NULL;
+	}
+
+	if (cf->nas_count == CFG_NAS_MAX)
+	{
+		fprintf(stderr, "Too many sections in configuration file\n");
+		return NULL;
+	}
+
+	nas = &cf->nas[cf->nas_count++];
+	snprintf(nas->name, sizeof(nas->name), "%s", section);
+	return nas;
+}
+
+static int
+config_copy(char *buf, int len, const char *name, const char *value)
+{
+	if (snprintf(buf, len, "%s", value) >= len)
+	{
+		fprintf(stderr, "Value for '%s' too long in configuration "
+							"file\n", name);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * "timeout" and "connect_timeout" set the deadlines of all requests,
+ * "list_timeout", "list_connect_timeout" etc. those of one kind. Returns
+ * the kind, SYNO_OPS for all of them, or -1 if name is none of these.
+ */
+static int
+timeout_key(const char *name, int *connect)
+{
+	char key[64];
+	const char *op;
+	int i;
+
+	for (i = 0; i <= SYNO_OPS; i++)
+	{
+		op = i < SYNO_OPS ? syno_op_name(i) : NULL;
+
+		snprintf(key, sizeof(key), "%s%stimeout", op ? op : "",
+								op ? "_" : "");
+		if (!strcmp(name, key))
+		{
+			*connect = 0;
+			return i;
+		}
+
+		snprintf(key, sizeof(key), "%s%sconnect_timeout",
+						op ? op : "", op ? "_" : "");
+		if (!strcmp(name, key))
+		{
+			*connect = 1;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int
+config_timeout(struct cfg *cf, const char *name, int kind, int connect,
+							const char *value)
+{
+	int ms;
+
+	ms = atof(value) * 1000;
+
+	if (ms < 1)
+	{
+		fprintf(stderr, "Invalid %s in configuration file\n", name);
+		return 0;
+	}
+
+	if (connect)
+		cf->connect_timeout[kind] = ms;
+	else
+		cf->timeout[kind] = ms;
+
+	return 1;
+}
+
+static int
+config_stall_action(struct cfg *cf, const char *value)
+{
+	if (!strcmp(value, "none"))
+		cf->stall.action = STALL_NONE;
+	else if (!strcmp(value, "cycle"))
+		cf->stall.action = STALL_CYCLE;
+	else if (!strcmp(value, "back"))
+		cf->stall.action = STALL_BACK;
+	else
+	{
+		fprintf(stderr, "Invalid stall_action in configuration file, "
+				"expected none, cycle or back\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* "hook_finished" etc., see event_names */
+static int
+config_hook(struct cfg *cf, const char *name, const char *value)
+{
+	int i;
+
+	for (i = 0; i < EVENTS; i++)
+	{
+		if (!strcmp(name + 5, event_names[i]))
+		{
+			return config_copy(cf->hooks.cmd[i],
+					sizeof(cf->hooks.cmd[i]), name, value);
+		}
+	}
+
+	fprintf(stderr, "Unknown hook in configuration file: %s\n", name);
+	return 0;
+}
+
 static int
 config_cb(void* user, const char* s, const char* name, const char* value)
 {
 	struct cfg *cf;
+	struct cfg_nas *nas;
+	int kind, connect;
 
 	cf = (struct cfg *) user;
 
-	if (!strcmp(name, "user"))
-		snprintf(cf->user, sizeof(cf->user), "%s", value);
-	else if (!strcmp(name, "password"))
-		snprintf(cf->pw, sizeof(cf->pw), "%s", value);
-	else if (!strcmp(name, "url"))
-		snprintf(cf->url, sizeof(cf->url), "%s", value);
+	if (!strcmp(name, "user") || !strcmp(name, "password") ||
+							!strcmp(name, "url"))
+	{
+		if (!(nas = config_nas(cf, s)))
+			return 0;
+		else if (!strcmp(name, "user"))
+			return config_copy(nas->user, sizeof(nas->user), name,
+									value);
+		else if (!strcmp(name, "password"))
+			return config_copy(nas->pw, sizeof(nas->pw), name,
+									value);
+		else
+			return config_copy(nas->url, sizeof(nas->url), name,
+									value);
+	}
+
+	/* there is one of everything else, wherever it is */
+	if (strcmp(s, ""))
+	{
+		fprintf(stderr, "Warning: %s in [%s] applies to all "
+				"DiskStations, it belongs before the first "
+				"section\n", name, s);
+	}
+
+	if (!strcmp(name, "poll_min"))
+		cf->poll_min = atof(value) * 1000;
+	else if (!strcmp(name, "poll_max"))
+		cf->poll_max = atof(value) * 1000;
+	else if (!strcmp(name, "heartbeat"))
+		cf->heartbeat = atof(value) * 1000;
+	else if (!strcmp(name, "queue_active"))
+		cf->queue.active = atoi(value);
+	else if (!strcmp(name, "queue_slack"))
+		cf->queue.slack = atoi(value);
+	else if (!strcmp(name, "queue_hold"))
+		cf->queue.hold = atoi(value);
+	else if (!strcmp(name, "queue_state"))
+		return config_copy(cf->queue.state, sizeof(cf->queue.state),
+								name, value);
+	else if (!strcmp(name, "stall_window"))
+		cf->stall.window = atoi(value);
+	else if (!strcmp(name, "stall_action"))
+		return config_stall_action(cf, value);
+	else if (!strcmp(name, "seed_ratio"))
+		cf->cleanup.ratio = atof(value);
+	else if (!strcmp(name, "seed_hours"))
+		cf->cleanup.seed_hours = atoi(value);
+	else if (!strcmp(name, "http_hours"))
+		cf->cleanup.http_hours = atoi(value);
+	else if (!strcmp(name, "cleanup_state"))
+		return config_copy(cf->cleanup.state,
+				sizeof(cf->cleanup.state), name, value);
+	else if (!strcmp(name, "cleanup_dry_run"))
+		cf->cleanup.dry_run = !strcmp(value, "yes") ||
+				!strcmp(value, "true") || !strcmp(value, "1");
+	else if (!strcmp(name, "hook_workers"))
+		cf->hooks.workers = atoi(value);
+	else if (!strncmp(name, "hook_", 5))
+		return config_hook(cf, name, value);
+	else if (!strcmp(name, "schedule"))
+		return config_schedule(&cf->schedule, value) == 0;
+	else if (!strcmp(name, "history"))
+		return config_copy(cf->history, sizeof(cf->history), name,
+									value);
+	else if ((kind = timeout_key(name, &connect)) >= 0)
+		return config_timeout(cf, name, kind, connect, value);
 
 	return 1;
 }
 
+/* "https://ds.example.com:5001/" -> "ds.example.com" */
+static const char *
+host_name(const char *url)
+{
+	static char buf[32];
+	const char *p;
+	int len;
+
+	p = strstr(url, "://");
+	p = p ? p + 3 : url;
+	len = strcspn(p, ":/");
+
+	snprintf(buf, sizeof(buf), "%.*s", len, p);
+	return buf;
+}
+
 int
 load_config(struct cfg *config)
 {
-	int res;
+	int res, i;
 	char fn[1024];
 	struct passwd *pw;
+	struct cfg_nas *nas;
 	const char *homedir;
 
 	pw = getpwuid(getuid());
@@ -60,6 +459,20 @@ load_config(struct cfg *config)
 	}
 	homedir = pw->pw_dir;
 
+	config->poll_min = 2000;
+	config->poll_max = 60000;
+	config->heartbeat = 1000;
+	config->queue.slack = 1;
+	config->queue.hold = 60;
+	snprintf(config->queue.state, sizeof(config->queue.state),
+							"~/.synodl-queue");
+	snprintf(config->cleanup.state, sizeof(config->cleanup.state),
+							"~/.synodl-cleanup");
+	config->stall.window = 600;
+	config->hooks.workers = 2;
+	config->connect_timeout[SYNO_OPS] = 10000;
+	config->timeout[SYNO_OPS] = 30000;
+
 	snprintf(fn, sizeof(fn), "%s/.synodl", homedir);
 	res = ini_parse(fn, config_cb, config);
 
@@ -74,21 +487,119 @@ load_config(struct cfg *config)
 		return 1;
 	}
 
-	if (!strcmp(config->user, ""))
+	if (config->nas_count == 0)
+	{
+		fprintf(stderr, "No DiskStation in configuration file\n");
+		return 1;
+	}
+
+	for (i = 0; i < config->nas_count; i++)
 	{
-		fprintf(stderr, "User name missing from configuration file\n");
+		nas = &config->nas[i];
+
+		/* the one at the top goes by its address */
+		if (!strcmp(nas->name, ""))
+		{
+			snprintf(nas->name, sizeof(nas->name), "%s",
+						host_name(nas->url));
+		}
+
+		if (!strcmp(nas->user, ""))
+		{
+			fprintf(stderr, "User name missing for %s\n",
+								nas->name);
+			return 1;
+		}
+		if (!strcmp(nas->pw, ""))
+		{
+			fprintf(stderr, "Password missing for %s\n", nas->name);
+			return 1;
+		}
+		if (!strcmp(nas->url, ""))
+		{
+			fprintf(stderr, "URL missing for %s\n", nas->name);
+			return 1;
+		}
+	}
+
+	if (config->poll_min < 100 || config->poll_max < config->poll_min)
+	{
+		fprintf(stderr, "Invalid poll_min/poll_max in configuration "
+								"file\n");
 		return 1;
 	}
-	if (!strcmp(config->pw, ""))
+
+	if (config->hooks.workers < 1 ||
+			config->hooks.workers > HOOKS_WORKERS_MAX)
 	{
-		fprintf(stderr, "Password missing from configuration file\n");
+		fprintf(stderr, "Invalid hook_workers in configuration file\n");
 		return 1;
 	}
-	if (!strcmp(config->url, ""))
+
+	if (config->queue.active < 0 || config->queue.slack < 0 ||
+						config->queue.hold < 0)
 	{
-		fprintf(stderr, "URL from configuration file\n");
+		fprintf(stderr, "Invalid queue_active/queue_slack/queue_hold "
+					"in configuration file\n");
 		return 1;
 	}
 
+	for (i = 0; i < SYNO_OPS; i++)
+	{
+		if (!config->timeout[i])
+		{
+			config->timeout[i] = config->timeout[SYNO_OPS];
+		}
+
+		if (!config->connect_timeout[i])
+		{
+			config->connect_timeout[i] =
+					config->connect_timeout[SYNO_OPS];
+		}
+	}
+
+	if (!strncmp(config->history, "~/", 2))
+	{
+		snprintf(fn, sizeof(fn), "%s/%s", homedir, config->history + 2);
+		snprintf(config->history, sizeof(config->history), "%s", fn);
+	}
+
+	if (!strncmp(config->queue.state, "~/", 2))
+	{
+		snprintf(fn, sizeof(fn), "%s/%s", homedir,
+						config->queue.state + 2);
+		snprintf(config->queue.state, sizeof(config->queue.state),
+								"%s", fn);
+	}
+
+	if (!strncmp(config->cleanup.state, "~/", 2))
+	{
+		snprintf(fn, sizeof(fn), "%s/%s", homedir,
+						config->cleanup.state + 2);
+		snprintf(config->cleanup.state, sizeof(config->cleanup.state),
+								"%s", fn);
+	}
+
 	return 0;
 }
+
+/* a new session with the deadlines from the configuration, NULL on failure */
+struct session *
+config_session(const struct cfg *config)
+{
+	struct session *s;
+	int i;
+
+	if (!(s = syno_new()))
+	{
+		return NULL;
+	}
+
+	for (i = 0; i < SYNO_OPS; i++)
+	{
+		syno_set_timeout(s, i, config->connect_timeout[i],
+							config->timeout[i]);
+	}
+
+	return s;
+}
@@ -21,12 +21,42 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef __SYNO_DL_CFG_H
 #define __SYNO_DL_CFG_H
 
+#include "cleanup.h"
+#include "hooks.h"
+#include "queue.h"
+#include "schedule.h"
+#include "stall.h"
+#include "syno.h"
+
+#define CFG_NAS_MAX 16
+
+/* one DiskStation, from a [section] or the top of the file */
+struct cfg_nas
+{
+	char name[32];
+	char user[128];
+	char pw[128];
+	char url[512];
+};
+
 struct cfg
 {
-	char user[32];
-	char pw[32];
-	char url[64];
+	struct cfg_nas nas[CFG_NAS_MAX];
+	int nas_count;
+	int poll_min;	/* ms */
+	int poll_max;	/* ms */
+	int heartbeat;	/* ms, 0 to disable */
+	char history[1024];	/* transfer log, empty to disable */
+	struct queue_policy queue;
+	struct stall_policy stall;
+	struct schedule schedule;
+	struct cleanup_policy cleanup;
+	struct hook_policy hooks;
+	/* ms per kind of request, the last for those not given, 0 if unset */
+	int connect_timeout[SYNO_OPS + 1];
+	int timeout[SYNO_OPS + 1];	/* for the whole request */
 };
 
 int load_config(struct cfg *config);
+struct session *config_session(const struct cfg *config);
 #endif
@@ -0,0 +1,314 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cleanup.h"
+#include "queue.h"
+#include "tasks.h"
+
+/*
+ * Removes finished tasks by the rules in the configuration file. The task
+ * list does not say since when a task has been done, so the hours count
+ * from when synodl first saw it finished or seeding.
+ *
+ * Those times are kept in the state file, one "nas id time" line per task
+ * that is done, so that they carry over to the next run.
+ */
+
+struct saved
+{
+	int nas;	/* -1 once the list of that NAS has come in */
+	char id[16];
+	long done_at;
+};
+
+static struct cleanup_policy policy;
+
+/* read from the state file, and what we last wrote to it */
+static struct saved *saved;
+static int nsaved;
+static char *written;
+
+/* the file as save() would write it, to be freed by the caller */
+static char *
+state_text()
+{
+	struct tasklist_ent *ent;
+	char *buf;
+	int i, n, len, size;
+
+	n = nsaved;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		n += ent->done_at != 0;
+	}
+
+	size = n * (sizeof(saved->id) + 32) + 1;
+
+	if (!(buf = malloc(size)))
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	buf[0] = 0;
+	len = 0;
+
+	/* of boxes that have not sent a list yet */
+	for (i = 0; i < nsaved; i++)
+	{
+		if (saved[i].nas >= 0)
+		{
+			len += snprintf(buf + len, size - len, "%d %s %ld\n",
+				saved[i].nas, saved[i].id, saved[i].done_at);
+		}
+	}
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->done_at)
+		{
+			len += snprintf(buf + len, size - len, "%d %s %ld\n",
+				ent->nas, ent->t->id, (long) ent->done_at);
+		}
+	}
+
+	return buf;
+}
+
+static void
+load(const char *fn)
+{
+	struct saved *tmp, s;
+	FILE *fh;
+
+	if (!(fh = fopen(fn, "r")))
+	{
+		return;
+	}
+
+	while (fscanf(fh, "%d %15s %ld", &s.nas, s.id, &s.done_at) == 3)
+	{
+		if (!(tmp = realloc(saved, (nsaved + 1) * sizeof(*saved))))
+		{
+			fprintf(stderr, "Realloc failed\n");
+			break;
+		}
+
+		saved = tmp;
+		memcpy(&saved[nsaved++], &s, sizeof(struct saved));
+	}
+
+	fclose(fh);
+}
+
+/* writes the state file if the tasks that are done have changed */
+static void
+save()
+{
+	char tmp[sizeof(policy.state) + 8];
+	char *text;
+	FILE *fh;
+
+	if (!strcmp(policy.state, "") || !(text = state_text()))
+	{
+		return;
+	}
+
+	if (written && !strcmp(text, written))
+	{
+		free(text);
+		return;
+	}
+
+	free(written);
+	written = text;
+
+	if (!strcmp(text, ""))
+	{
+		if (unlink(policy.state) != 0 && errno != ENOENT)
+		{
+			perror(policy.state);
+		}
+
+		return;
+	}
+
+	/* a run cut short must not leave half a file */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", policy.state);
+
+	if (!(fh = fopen(tmp, "w")))
+	{
+		perror(tmp);
+		return;
+	}
+
+	fputs(text, fh);
+
+	if (fclose(fh) != 0 || rename(tmp, policy.state) != 0)
+	{
+		perror(policy.state);
+	}
+}
+
+/* when an earlier run first saw the task done, or now */
+static time_t
+done_since(struct tasklist_ent *ent, time_t now)
+{
+	int i;
+
+	for (i = 0; i < nsaved; i++)
+	{
+		if (saved[i].nas == ent->nas && !strcmp(saved[i].id,
+								ent->t->id))
+		{
+			return saved[i].done_at < now ? saved[i].done_at : now;
+		}
+	}
+
+	return now;
+}
+
+void
+cleanup_init(const struct cleanup_policy *p)
+{
+	memcpy(&policy, p, sizeof(struct cleanup_policy));
+
+	if (strcmp(policy.state, ""))
+	{
+		load(policy.state);
+		written = state_text();
+	}
+}
+
+static int
+done(const char *status)
+{
+	return !strcmp(status, "finished") || !strcmp(status, "seeding");
+}
+
+/* whether the rules say the task can go */
+static int
+due(struct tasklist_ent *ent, time_t now)
+{
+	struct task *t = ent->t;
+	double hours;
+
+	hours = (now - ent->done_at) / 3600.0;
+
+	if (!strcmp(t->type, "bt"))
+	{
+		return (policy.ratio > 0 && t->size > 0 &&
+				(double) t->uploaded / t->size >= policy.ratio) ||
+			(policy.seed_hours > 0 && hours >= policy.seed_hours);
+	}
+
+	if (!strcmp(t->type, "http") || !strcmp(t->type, "ftp"))
+	{
+		return policy.http_hours > 0 && hours >= policy.http_hours;
+	}
+
+	return 0;
+}
+
+/*
+ * Goes through the tasks of a NAS after a refresh and hands those that are
+ * due to remove(), which takes them out of the list. In a dry run they are
+ * only flagged as expired. Returns the number of tasks that are due.
+ */
+int
+cleanup_run(int nas, void (*remove)(struct tasklist_ent *))
+{
+	struct tasklist_ent *ent, *next;
+	time_t now;
+	int i, n, expired;
+
+	if (policy.ratio <= 0 && policy.seed_hours <= 0 &&
+						policy.http_hours <= 0)
+	{
+		return 0;
+	}
+
+	now = time(NULL);
+	n = 0;
+
+	for (ent = tasks; ent; ent = next)
+	{
+		next = ent->next;
+
+		if (ent->nas != nas)
+		{
+			continue;
+		}
+
+		if (!done(ent->t->status))
+		{
+			ent->done_at = 0;
+			expired = 0;
+		}
+		else
+		{
+			if (!ent->done_at)
+			{
+				ent->done_at = done_since(ent, now);
+			}
+
+			/* a delete that failed is not tried again right away */
+			expired = due(ent, now) && !queue_held(ent);
+		}
+
+		if (expired != ent->expired)
+		{
+			ent->expired = expired;
+			ent->dirty = 1;
+		}
+
+		if (!expired)
+		{
+			continue;
+		}
+
+		n++;
+
+		if (!policy.dry_run)
+		{
+			remove(ent);
+		}
+	}
+
+	/* what the list did not have is gone, the rest is in the list now */
+	for (i = 0; i < nsaved; i++)
+	{
+		if (saved[i].nas == nas)
+		{
+			saved[i].nas = -1;
+		}
+	}
+
+	save();
+	return n;
+}
@@ -0,0 +1,39 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_CLEANUP_H
+#define __SYNODL_CLEANUP_H
+
+#include "tasks.h"
+
+/* when finished tasks go, 0 for never */
+struct cleanup_policy
+{
+	double ratio;	/* uploaded / size of a BitTorrent task */
+	int seed_hours;	/* seeding or finished for this long */
+	int http_hours;	/* direct (HTTP, FTP) downloads finished this long */
+	int dry_run;	/* only show which tasks would go */
+	char state[1024];	/* file of when tasks were done, "" for none */
+};
+
+void cleanup_init(const struct cleanup_policy *policy);
+int cleanup_run(int nas, void (*remove)(struct tasklist_ent *));
+
+#endif
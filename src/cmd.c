@@ -0,0 +1,445 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "cmd.h"
+#include "nas.h"
+#include "syno.h"
+
+/* commands of the same kind are sent together, up to this many ids */
+#define CMD_BATCH 100
+
+static const char *method_names[] = { "pause", "resume", "delete", "create" };
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+static struct cmd *queue, *done;
+static int pending, uploads, running;
+
+/* the batch being sent is one of uploads, which the user may give up on */
+static int uploading, cancel;
+
+/* the worker has sessions (and connections) of its own */
+static struct session *sessions[CFG_NAS_MAX];
+
+static void
+append(struct cmd **list, struct cmd *c)
+{
+	while (*list)
+	{
+		list = &(*list)->next;
+	}
+
+	c->next = NULL;
+	*list = c;
+}
+
+/*
+ * Takes the first queued command plus as many others with the same method
+ * and NAS as fit into one request URL, and writes their comma-separated ids.
+ * Uploads are sent together however many there are, up to CMD_BATCH.
+ */
+static struct cmd *
+take_batch(char *ids, int size)
+{
+	struct cmd **p, *batch, *c;
+	struct session *s;
+	int n, len, budget;
+
+	batch = queue;
+	queue = queue->next;
+	batch->next = NULL;
+
+	/* without a session, the batch is not going anywhere anyway */
+	s = sessions[batch->nas];
+	budget = s ? size - 1 - syno_task_url(NULL, 0, nas_url(batch->nas), s,
+					method_names[batch->method], "") : 0;
+	len = snprintf(ids, size, "%s", batch->t.id);
+
+	p = &queue;
+	n = 1;
+
+	while (*p && n < CMD_BATCH)
+	{
+		c = *p;
+
+		if (c->method != batch->method || c->nas != batch->nas)
+		{
+			p = &c->next;
+			continue;
+		}
+
+		if (c->method != CMD_UPLOAD)
+		{
+			if (len + 1 + strlen(c->t.id) > budget)
+			{
+				break;
+			}
+
+			len += snprintf(ids + len, size - len, ",%s", c->t.id);
+		}
+
+		*p = c->next;
+		append(&batch, c);
+		n++;
+	}
+
+	return batch;
+}
+
+/* lets cmd_cancel() stop the uploads under way */
+static int
+cancelled(void *arg, int64_t bytes, double elapsed)
+{
+	int stop;
+
+	pthread_mutex_lock(&lock);
+	stop = cancel;
+	pthread_mutex_unlock(&lock);
+
+	return stop;
+}
+
+/* each file gets its own result */
+static int
+run_uploads(struct cmd *batch, const char *base, struct session *s)
+{
+	char *files[CMD_BATCH];
+	int res[CMD_BATCH], n, failed;
+	struct cmd *c;
+
+	for (c = batch, n = 0; c; c = c->next)
+	{
+		files[n++] = c->file;
+	}
+
+	syno_set_progress(s, cancelled, NULL);
+	failed = syno_upload(base, s, files, n, res);
+	syno_set_progress(s, NULL, NULL);
+
+	for (c = batch, n = 0; c; c = c->next, n++)
+	{
+		c->res = res[n] != 0;
+		c->error = res[n];
+	}
+
+	return failed;
+}
+
+static int
+run_batch(struct cmd *batch, const char *ids)
+{
+	const char *base = nas_url(batch->nas);
+	struct session *s = sessions[batch->nas];
+
+	switch (batch->method)
+	{
+	case CMD_PAUSE:
+		return syno_pause(base, s, ids);
+	case CMD_RESUME:
+		return syno_resume(base, s, ids);
+	case CMD_UPLOAD:
+		return run_uploads(batch, base, s);
+	default:
+		return syno_delete(base, s, ids);
+	}
+}
+
+static void *
+work(void *arg)
+{
+	struct cmd *batch, *c, *next;
+	char ids[SYNO_URL_MAX];
+	int res, nas, offline;
+
+	pthread_mutex_lock(&lock);
+
+	/* once stopped, what is still queued gets sent before we go */
+	while (running || queue)
+	{
+		if (!queue)
+		{
+			pthread_cond_wait(&wakeup, &lock);
+			continue;
+		}
+
+		/* only the worker takes commands off the queue */
+		nas = queue->nas;
+
+		pthread_mutex_unlock(&lock);
+		offline = nas_session(nas, &sessions[nas]);
+		pthread_mutex_lock(&lock);
+
+		/* uploads cancelled while we waited for the session */
+		if (!queue || queue->nas != nas)
+		{
+			continue;
+		}
+
+		batch = take_batch(ids, sizeof(ids));
+		uploading = batch->method == CMD_UPLOAD;
+		cancel = 0;
+
+		pthread_mutex_unlock(&lock);
+		res = offline || run_batch(batch, ids);
+		pthread_mutex_lock(&lock);
+
+		uploading = 0;
+
+		for (c = batch; c; c = next)
+		{
+			next = c->next;
+
+			/* uploads have their results already, unless offline */
+			if (offline || c->method != CMD_UPLOAD)
+			{
+				c->res = res;
+				c->error = offline ? 0 : syno_error(sessions[nas]);
+			}
+
+			append(&done, c);
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int
+cmd_start()
+{
+	memset(sessions, 0, sizeof(sessions));
+	running = 1;
+
+	if (pthread_create(&worker, NULL, work, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to start worker thread\n");
+		running = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* sends the commands still queued, then stops the worker */
+void
+cmd_stop()
+{
+	struct cmd *c;
+	int i;
+
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(worker, NULL);
+
+	while ((c = queue))
+	{
+		queue = c->next;
+		free(c);
+	}
+
+	while ((c = done))
+	{
+		done = c->next;
+		free(c);
+	}
+
+	pending = 0;
+	uploads = 0;
+
+	/* not logged out, the sessions belong to the NAS threads */
+	for (i = 0; i < CFG_NAS_MAX; i++)
+	{
+		syno_free(sessions[i]);
+		sessions[i] = NULL;
+	}
+}
+
+int
+cmd_submit(enum cmd_method method, int nas, struct task *t, int queued)
+{
+	struct cmd *c;
+
+	if (!running)
+	{
+		return 1;
+	}
+
+	if (!(c = malloc(sizeof(struct cmd))))
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return 1;
+	}
+
+	c->method = method;
+	c->nas = nas;
+	c->res = 0;
+	memcpy(&c->t, t, sizeof(struct task));
+	c->queued = queued;
+	c->file[0] = 0;
+
+	pthread_mutex_lock(&lock);
+	append(&queue, c);
+	pending += 1;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Adds a .torrent/.nzb file as a download task on NAS nas. The upload does
+ * not hold up task commands, cmd_pending() does not count it.
+ */
+int
+cmd_upload(int nas, const char *file)
+{
+	struct cmd *c;
+
+	if (!running)
+	{
+		return 1;
+	}
+
+	if (strlen(file) >= sizeof(c->file))
+	{
+		fprintf(stderr, "File name too long: %s\n", file);
+		return 1;
+	}
+
+	if (!(c = calloc(1, sizeof(struct cmd))))
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return 1;
+	}
+
+	c->method = CMD_UPLOAD;
+	c->nas = nas;
+	snprintf(c->file, sizeof(c->file), "%s", file);
+	snprintf(c->t.fn, sizeof(c->t.fn), "%s", file);
+
+	pthread_mutex_lock(&lock);
+	append(&queue, c);
+	uploads += 1;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Gives up on the uploads, those under way and those still queued; they
+ * come back from cmd_done() as failed. Returns 0 if there were none.
+ */
+int
+cmd_cancel()
+{
+	struct cmd **p, *c;
+	int res;
+
+	pthread_mutex_lock(&lock);
+
+	res = uploading;
+	cancel = uploading;
+	p = &queue;
+
+	while ((c = *p))
+	{
+		if (c->method != CMD_UPLOAD)
+		{
+			p = &c->next;
+			continue;
+		}
+
+		*p = c->next;
+		c->res = 1;
+		c->error = -CURLE_ABORTED_BY_CALLBACK;
+		append(&done, c);
+		res = 1;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return res;
+}
+
+/* returns the next finished command, to be freed by the caller */
+struct cmd *
+cmd_done()
+{
+	struct cmd *c;
+
+	pthread_mutex_lock(&lock);
+
+	if ((c = done) && c->method == CMD_UPLOAD)
+	{
+		done = c->next;
+		uploads -= 1;
+	}
+	else if (c)
+	{
+		done = c->next;
+		pending -= 1;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return c;
+}
+
+/* number of task commands submitted but not yet collected */
+int
+cmd_pending()
+{
+	int n;
+
+	pthread_mutex_lock(&lock);
+	n = pending;
+	pthread_mutex_unlock(&lock);
+
+	return n;
+}
+
+/* number of uploads submitted but not yet collected */
+int
+cmd_uploads()
+{
+	int n;
+
+	pthread_mutex_lock(&lock);
+	n = uploads;
+	pthread_mutex_unlock(&lock);
+
+	return n;
+}
@@ -0,0 +1,56 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_CMD_H
+#define __SYNODL_CMD_H
+
+#include "syno.h"
+
+enum cmd_method
+{
+	CMD_PAUSE,
+	CMD_RESUME,
+	CMD_DELETE,
+	CMD_UPLOAD
+};
+
+/* a task command or file upload, executed in the background */
+struct cmd
+{
+	enum cmd_method method;
+	int nas;
+	struct task t;		/* the task as it was before the command */
+	int queued;		/* ... and whether the queue manager had it */
+	char file[1024];	/* to be uploaded */
+	int res;
+	int error;		/* see syno_strerror() */
+	struct cmd *next;
+};
+
+int cmd_start();
+void cmd_stop();
+int cmd_submit(enum cmd_method method, int nas, struct task *t, int queued);
+int cmd_upload(int nas, const char *file);
+int cmd_cancel();
+struct cmd *cmd_done();
+int cmd_pending();
+int cmd_uploads();
+
+#endif
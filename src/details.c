@@ -0,0 +1,292 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "details.h"
+#include "nas.h"
+#include "poller.h"
+#include "syno.h"
+
+/*
+ * Task details are fetched by a worker thread of their own, so that the
+ * detail window can stay responsive and rows next to the cursor can be
+ * fetched before anyone asks for them. Requests are served newest first;
+ * once the queue is full the oldest ones are dropped.
+ */
+
+/* tasks kept in the cache, torrents with many files are big */
+#define DETAILS_CACHE 16
+#define DETAILS_QUEUE 8
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static int running;
+
+static struct details cache[DETAILS_CACHE];
+static int queued;
+
+static struct
+{
+	int nas;
+	char id[16];
+} queue[DETAILS_QUEUE];
+
+static struct session *sessions[CFG_NAS_MAX];
+
+static struct details *
+cache_find(int nas, const char *id)
+{
+	int i;
+
+	for (i = 0; i < DETAILS_CACHE; i++)
+	{
+		if (cache[i].nas == nas && !strcmp(cache[i].id, id))
+		{
+			return &cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* the slot for id, taking over the least recently used one if need be */
+static struct details *
+cache_get(int nas, const char *id)
+{
+	struct details *d;
+	int i;
+
+	if ((d = cache_find(nas, id)))
+	{
+		return d;
+	}
+
+	d = &cache[0];
+
+	for (i = 1; i < DETAILS_CACHE; i++)
+	{
+		if (cache[i].used < d->used)
+		{
+			d = &cache[i];
+		}
+	}
+
+	syno_info_free(&d->info);
+	memset(d, 0, sizeof(struct details));
+	snprintf(d->id, sizeof(d->id), "%s", id);
+	d->nas = nas;
+	d->used = now_ms();
+	return d;
+}
+
+/* a request still under way when we stop is not waited for */
+static int
+stopping(void *arg, int64_t bytes, double elapsed)
+{
+	int stop;
+
+	pthread_mutex_lock(&lock);
+	stop = !running;
+	pthread_mutex_unlock(&lock);
+
+	return stop;
+}
+
+/* gets the session for NAS nas ready for a request */
+static int
+prepare(int nas)
+{
+	if (nas_session(nas, &sessions[nas]) != 0)
+	{
+		return 1;
+	}
+
+	syno_set_progress(sessions[nas], stopping, NULL);
+	return 0;
+}
+
+static void *
+work(void *arg)
+{
+	struct task_info info;
+	struct details *d;
+	char id[16];
+	int res, nas;
+
+	pthread_mutex_lock(&lock);
+
+	while (running)
+	{
+		if (queued == 0)
+		{
+			pthread_cond_wait(&wakeup, &lock);
+			continue;
+		}
+
+		memcpy(id, queue[0].id, sizeof(id));
+		nas = queue[0].nas;
+		memmove(&queue[0], &queue[1], (queued - 1) * sizeof(queue[0]));
+		queued -= 1;
+
+		pthread_mutex_unlock(&lock);
+		res = prepare(nas) ||
+			syno_info(nas_url(nas), sessions[nas], id, &info);
+		pthread_mutex_lock(&lock);
+
+		d = cache_get(nas, id);
+		d->res = res;
+		d->fetched = now_ms();
+
+		/* keep what we had if the fetch failed */
+		if (res == 0)
+		{
+			syno_info_free(&d->info);
+			memcpy(&d->info, &info, sizeof(struct task_info));
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int
+details_start()
+{
+	memset(sessions, 0, sizeof(sessions));
+	running = 1;
+
+	if (pthread_create(&worker, NULL, work, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to start worker thread\n");
+		running = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+details_stop()
+{
+	int i;
+
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(worker, NULL);
+
+	for (i = 0; i < DETAILS_CACHE; i++)
+	{
+		syno_info_free(&cache[i].info);
+	}
+
+	memset(cache, 0, sizeof(cache));
+	queued = 0;
+
+	/* not logged out, the sessions belong to the NAS threads */
+	for (i = 0; i < CFG_NAS_MAX; i++)
+	{
+		syno_free(sessions[i]);
+		sessions[i] = NULL;
+	}
+}
+
+/* asks for the details of a task unless we have some younger than max_age */
+void
+details_want(int nas, const char *id, int max_age)
+{
+	struct details *d;
+	int i;
+
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	d = cache_find(nas, id);
+
+	if (d && d->fetched && now_ms() - d->fetched < max_age)
+	{
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	for (i = 0; i < queued && (queue[i].nas != nas ||
+					strcmp(queue[i].id, id)); i++)
+		;
+
+	/* move it to the front */
+	if (i == queued && queued == DETAILS_QUEUE)
+	{
+		i -= 1;
+	}
+	else if (i == queued)
+	{
+		queued += 1;
+	}
+
+	memmove(&queue[1], &queue[0], i * sizeof(queue[0]));
+	snprintf(queue[0].id, sizeof(queue[0].id), "%s", id);
+	queue[0].nas = nas;
+
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Returns the cached details of a task, or NULL if there are none yet. The
+ * cache stays locked until details_unlock(), so keep it short.
+ */
+struct details *
+details_lock(int nas, const char *id)
+{
+	struct details *d;
+
+	pthread_mutex_lock(&lock);
+
+	if ((d = cache_find(nas, id)) && d->fetched)
+	{
+		d->used = now_ms();
+		return d;
+	}
+
+	return NULL;
+}
+
+void
+details_unlock()
+{
+	pthread_mutex_unlock(&lock);
+}
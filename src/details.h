@@ -0,0 +1,47 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_DETAILS_H
+#define __SYNODL_DETAILS_H
+
+#include "syno.h"
+
+/* ms until cached details are fetched again, and while they are on screen */
+#define DETAILS_TTL 30000
+#define DETAILS_LIVE 2000
+
+/* a cached getinfo result */
+struct details
+{
+	int nas;
+	char id[16];
+	struct task_info info;
+	double fetched;	/* ms, 0 while the first fetch is under way */
+	double used;
+	int res;	/* of the last fetch */
+};
+
+int details_start();
+void details_stop();
+void details_want(int nas, const char *id, int max_age);
+struct details *details_lock(int nas, const char *id);
+void details_unlock();
+
+#endif
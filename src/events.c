@@ -0,0 +1,202 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "events.h"
+#include "syno.h"
+#include "tasks.h"
+
+/*
+ * Compares the tasks of a NAS with what they were at its last refresh and
+ * reports what happened to them. The first list of a NAS is taken as it
+ * is, without reporting all of its tasks as added.
+ */
+
+/* the tasks at the last refresh, sorted by id */
+struct snapshot
+{
+	struct task *tasks;
+	int n;
+	int cap;
+	int taken;	/* there was a refresh before */
+};
+
+static struct snapshot snaps[CFG_NAS_MAX];
+static struct snapshot next;
+
+static int
+by_id(const void *pa, const void *pb)
+{
+	return strcmp(((const struct task *) pa)->id,
+					((const struct task *) pb)->id);
+}
+
+static int
+done(const char *status)
+{
+	return !strcmp(status, "finished") || !strcmp(status, "seeding");
+}
+
+/* what DownloadStation reports when a task has failed, e.g. broken_link */
+static int
+failed(const char *status)
+{
+	static const char *fine[] = {
+		"waiting", "downloading", "paused", "finishing", "finished",
+		"hash_checking", "seeding", "filehosting_waiting",
+		"extracting", NULL
+	};
+	int i;
+
+	for (i = 0; fine[i]; i++)
+	{
+		if (!strcmp(status, fine[i]))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+take(struct snapshot *s, int nas)
+{
+	struct tasklist_ent *ent;
+	struct task *tmp;
+	int cap;
+
+	s->n = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->nas != nas)
+		{
+			continue;
+		}
+
+		if (s->n == s->cap)
+		{
+			cap = s->cap ? s->cap * 2 : 256;
+
+			if (!(tmp = realloc(s->tasks, cap * sizeof(struct task))))
+			{
+				fprintf(stderr, "Realloc failed\n");
+				return 1;
+			}
+
+			s->tasks = tmp;
+			s->cap = cap;
+		}
+
+		memcpy(&s->tasks[s->n++], ent->t, sizeof(struct task));
+	}
+
+	qsort(s->tasks, s->n, sizeof(struct task), by_id);
+	return 0;
+}
+
+static void
+changed(int nas, const struct task *old, const struct task *cur,
+	void (*cb)(enum event_type, int, const struct task *,
+						const struct task *))
+{
+	if (!strcmp(old->status, cur->status))
+	{
+		return;
+	}
+
+	cb(EVENT_STATUS, nas, old, cur);
+
+	if (done(cur->status) && !done(old->status))
+	{
+		cb(EVENT_FINISHED, nas, old, cur);
+	}
+	else if (failed(cur->status) && !failed(old->status))
+	{
+		cb(EVENT_ERROR, nas, old, cur);
+	}
+}
+
+/* to be called after each full refresh of the NAS */
+void
+events_diff(int nas, void (*cb)(enum event_type, int, const struct task *,
+						const struct task *))
+{
+	struct snapshot *prev, tmp;
+	int i, k, cmp;
+
+	prev = &snaps[nas];
+
+	if (take(&next, nas) != 0)
+	{
+		return;
+	}
+
+	/* both are sorted, walk them side by side */
+	for (i = 0, k = 0; prev->taken && (i < prev->n || k < next.n); )
+	{
+		if (i == prev->n)
+			cmp = 1;
+		else if (k == next.n)
+			cmp = -1;
+		else
+			cmp = strcmp(prev->tasks[i].id, next.tasks[k].id);
+
+		if (cmp < 0)
+		{
+			cb(EVENT_REMOVED, nas, &prev->tasks[i++], NULL);
+		}
+		else if (cmp > 0)
+		{
+			cb(EVENT_ADDED, nas, NULL, &next.tasks[k++]);
+		}
+		else
+		{
+			changed(nas, &prev->tasks[i++], &next.tasks[k++], cb);
+		}
+	}
+
+	/* keep the new one, and the old buffer for next time */
+	memcpy(&tmp, prev, sizeof(struct snapshot));
+	memcpy(prev, &next, sizeof(struct snapshot));
+	memcpy(&next, &tmp, sizeof(struct snapshot));
+
+	prev->taken = 1;
+}
+
+void
+events_free()
+{
+	int i;
+
+	for (i = 0; i < CFG_NAS_MAX; i++)
+	{
+		free(snaps[i].tasks);
+	}
+
+	free(next.tasks);
+	memset(snaps, 0, sizeof(snaps));
+	memset(&next, 0, sizeof(next));
+}
@@ -0,0 +1,44 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_EVENTS_H
+#define __SYNODL_EVENTS_H
+
+#include "syno.h"
+
+enum event_type
+{
+	EVENT_ADDED,
+	EVENT_STATUS,	/* any change of status ... */
+	EVENT_FINISHED,	/* ... and, on top of that, these two */
+	EVENT_ERROR,
+	EVENT_REMOVED,
+	EVENTS
+};
+
+/* by kind of event, defined in cfg.c */
+extern const char *event_names[];
+
+/* cb gets the task before and after, old is NULL if it was added, cur if gone */
+void events_diff(int nas, void (*cb)(enum event_type type, int nas,
+			const struct task *old, const struct task *cur));
+void events_free();
+
+#endif
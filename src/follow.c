@@ -0,0 +1,222 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#ifdef HAVE_JSON_C
+#include <json-c/json.h>
+#else
+#include <json/json.h>
+#endif
+
+#include "cfg.h"
+#include "follow.h"
+#include "poller.h"
+#include "syno.h"
+#include "tasks.h"
+
+/*
+ * Prints the tasks of the first DiskStation as JSON lines: all of them at
+ * first, then only those that changed, were added or went away at each
+ * refresh. Every line has a sequence number, so that a reader can tell if
+ * it missed any. The list is fetched conditionally on one session and
+ * connection, an unchanged list costs next to nothing.
+ */
+
+static volatile sig_atomic_t stop;
+static int64_t seq;
+static const char *nas_name;
+
+static void
+quit(int sig)
+{
+	stop = 1;
+}
+
+static int
+relogin(struct session *s, void *arg)
+{
+	struct cfg_nas *nas = arg;
+
+	return syno_login(nas->url, s, nas->user, nas->pw);
+}
+
+static void
+print_line(const char *event, struct task *t, int removed)
+{
+	json_object *obj;
+
+	obj = json_object_new_object();
+
+	json_object_object_add(obj, "seq", json_object_new_int64(++seq));
+	json_object_object_add(obj, "event", json_object_new_string(event));
+	json_object_object_add(obj, "nas", json_object_new_string(nas_name));
+	json_object_object_add(obj, "id", json_object_new_string(t->id));
+
+	if (!removed)
+	{
+		json_object_object_add(obj, "title",
+					json_object_new_string(t->fn));
+		json_object_object_add(obj, "type",
+					json_object_new_string(t->type));
+		json_object_object_add(obj, "status",
+					json_object_new_string(t->status));
+		json_object_object_add(obj, "size",
+					json_object_new_int64(t->size));
+		json_object_object_add(obj, "downloaded",
+					json_object_new_int64(t->downloaded));
+		json_object_object_add(obj, "uploaded",
+					json_object_new_int64(t->uploaded));
+		json_object_object_add(obj, "speed_download",
+					json_object_new_int(t->speed_dn));
+		json_object_object_add(obj, "speed_upload",
+					json_object_new_int(t->speed_up));
+	}
+
+	printf("%s\n", json_object_to_json_string(obj));
+	json_object_put(obj);
+}
+
+static void
+gone(struct tasklist_ent *ent, void *arg)
+{
+	print_line("removed", ent->t, 1);
+}
+
+/* prints the tasks the last refresh added or changed */
+static int
+print_changes(int first)
+{
+	static unsigned int known;	/* tasks from before have lower seq */
+	struct tasklist_ent *ent;
+	unsigned int last;
+	int n;
+
+	n = 0;
+	last = known;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->seq >= last)
+		{
+			last = ent->seq + 1;
+		}
+
+		if (!ent->dirty)
+		{
+			continue;
+		}
+
+		print_line(first ? "snapshot" : ent->seq >= known ? "added" :
+							"changed", ent->t, 0);
+		ent->dirty = 0;
+		n++;
+	}
+
+	known = last;
+	return n;
+}
+
+int
+follow_tasks(struct cfg *config)
+{
+	struct cfg_nas *nas;
+	struct sigaction sa;
+	struct session *s;
+	struct syno_stats stats;
+	struct poller p;
+	struct timespec ts;
+	int res, first, changed, wait, nas_index;
+
+	nas = &config->nas[0];
+	nas_name = nas->name;
+	nas_index = 0;
+
+	if (!(s = config_session(config)))
+	{
+		return 1;
+	}
+
+	syno_set_relogin(s, relogin, nas);
+
+	if (syno_login(nas->url, s, nas->user, nas->pw) != 0)
+	{
+		syno_free(s);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = quit;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* a reader that went away shows as a failed write */
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	poller_init(&p, config->poll_min, config->poll_max);
+	first = 1;
+
+	while (!stop)
+	{
+		tasks_begin();
+		res = syno_list(nas->url, s, tasks_update, &nas_index);
+		syno_stats(s, &stats);
+		changed = 0;
+
+		if (res == 0)
+		{
+			tasks_sweep(nas_index, gone, NULL);
+			changed = print_changes(first) > 0;
+			first = 0;
+		}
+		else if (res != SYNO_UNCHANGED)
+		{
+			fprintf(stderr, "Failed to fetch the task list: %s\n",
+						syno_strerror(stats.error));
+		}
+
+		/* one batch at a time */
+		if (fflush(stdout) != 0)
+		{
+			break;
+		}
+
+		wait = poller_update(&p, changed, 0, stats.elapsed * 1000);
+
+		ts.tv_sec = wait / 1000;
+		ts.tv_nsec = (wait % 1000) * 1000000L;
+
+		while (!stop && nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+	}
+
+	syno_logout(nas->url, s);
+	syno_free(s);
+	tasks_free();
+
+	return 0;
+}
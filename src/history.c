@@ -0,0 +1,172 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "history.h"
+#include "poller.h"
+
+/* seconds for the smoothed rate to get 63% of the way to a new speed */
+#define TAU 6.0
+
+static const char *bars[] = { "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+
+static void
+put(struct history *h, unsigned int speed)
+{
+	h->dn[h->head] = speed;
+	h->head = (h->head + 1) % HISTORY_SAMPLES;
+
+	if (h->count < HISTORY_SAMPLES)
+	{
+		h->count += 1;
+	}
+}
+
+/*
+ * Takes the current speed as the speed since the last one came in, so a
+ * speed counts for as long as it stood, no matter how often we ask. The
+ * samples are averages over HISTORY_STEP seconds each.
+ */
+void
+history_push(struct history *h, int speed)
+{
+	double t, dt, part;
+
+	t = now_ms() / 1000;
+
+	if (speed < 0)
+	{
+		speed = 0;
+	}
+
+	if (h->at == 0)
+	{
+		h->at = t;
+		h->rate = speed;
+		return;
+	}
+
+	dt = t - h->at;
+	h->at = t;
+	h->rate += (1 - exp(-dt / TAU)) * (speed - h->rate);
+
+	/* after a long gap, all we know is this one speed */
+	if (dt > HISTORY_STEP * HISTORY_SAMPLES)
+	{
+		dt = HISTORY_STEP * HISTORY_SAMPLES;
+	}
+
+	while (dt > 0)
+	{
+		part = HISTORY_STEP - h->filled;
+		part = part < dt ? part : dt;
+
+		h->sum += (double) speed * part;
+		h->filled += part;
+		dt -= part;
+
+		if (h->filled >= HISTORY_STEP - 1e-9)
+		{
+			put(h, h->sum / HISTORY_STEP + 0.5);
+			h->filled = 0;
+			h->sum = 0;
+		}
+	}
+}
+
+/* seconds until left more bytes are in, or -1 if that is not in sight */
+double
+history_eta(struct history *h, int64_t left)
+{
+	if (left <= 0)
+	{
+		return 0;
+	}
+
+	if (h->rate < 1)
+	{
+		return -1;
+	}
+
+	return left / h->rate;
+}
+
+/* at most four characters */
+void
+history_format_eta(double eta, char *buf, int len)
+{
+	if (eta < 0)
+		snprintf(buf, len, "-");
+	else if (eta < 100)
+		snprintf(buf, len, "%ds", (int) eta);
+	else if (eta < 100 * 60)
+		snprintf(buf, len, "%dm", (int) (eta / 60));
+	else if (eta < 100 * 3600)
+		snprintf(buf, len, "%dh", (int) (eta / 3600));
+	else if (eta < 1000 * 86400)
+		snprintf(buf, len, "%dd", (int) (eta / 86400));
+	else
+		snprintf(buf, len, "-");
+}
+
+/* the last n samples as bars, scaled to the fastest among them */
+void
+history_spark(struct history *h, int n, char *buf, int len)
+{
+	unsigned int max;
+	int i, k, slot, used;
+
+	if (n > h->count)
+	{
+		n = h->count;
+	}
+
+	max = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		slot = (h->head - n + i + HISTORY_SAMPLES) % HISTORY_SAMPLES;
+
+		if (h->dn[slot] > max)
+		{
+			max = h->dn[slot];
+		}
+	}
+
+	buf[0] = 0;
+	used = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		slot = (h->head - n + i + HISTORY_SAMPLES) % HISTORY_SAMPLES;
+		k = max ? (int) ((double) h->dn[slot] * 7 / max + 0.5) : 0;
+
+		if (used + strlen(bars[k]) >= len)
+		{
+			break;
+		}
+
+		strcpy(buf + used, bars[k]);
+		used += strlen(bars[k]);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_HISTORY_H
+#define __SYNODL_HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_SAMPLES 32
+
+/* seconds each sample covers, however often speeds come in */
+#define HISTORY_STEP 2
+
+/* the download speeds of a task over the last minute or so, in a ring */
+struct history
+{
+	unsigned int dn[HISTORY_SAMPLES];
+	int head;	/* where the next sample goes */
+	int count;
+	double rate;	/* smoothed download speed */
+	double at;	/* when the last speed came in, 0 if none did */
+	double filled;	/* seconds of the next sample covered so far */
+	double sum;	/* ... and the bytes in them */
+};
+
+void history_push(struct history *h, int speed);
+double history_eta(struct history *h, int64_t left);
+void history_format_eta(double eta, char *buf, int len);
+void history_spark(struct history *h, int n, char *buf, int len);
+
+#endif
@@ -0,0 +1,365 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE	/* posix_spawn_file_actions_addclosefrom_np */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "events.h"
+#include "hooks.h"
+#include "syno.h"
+
+/*
+ * Runs the command configured for an event with /bin/sh, the task in
+ * environment variables (SYNODL_EVENT, SYNODL_ID, SYNODL_TITLE ...). A few
+ * threads run them one after the other, so a slow command never holds up
+ * the refresh; should the commands fall too far behind, new events are
+ * dropped rather than queued without end. Commands still running when we
+ * quit are left to finish on their own.
+ */
+
+#define HOOK_VARS 12
+
+extern char **environ;
+
+struct job
+{
+	enum event_type type;
+	char *env[HOOK_VARS];
+	struct job *next;
+};
+
+static struct hook_policy policy;
+static pthread_t workers[HOOKS_WORKERS_MAX];
+static int nworkers, running;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+static struct job *queue, **tail = &queue;
+static int queued;
+
+static void
+free_job(struct job *j)
+{
+	int i;
+
+	for (i = 0; i < HOOK_VARS && j->env[i]; i++)
+	{
+		free(j->env[i]);
+	}
+
+	free(j);
+}
+
+/* our variables first, then whatever we were started with */
+static char **
+make_env(struct job *j)
+{
+	char **env;
+	int n, i, k;
+
+	for (n = 0; environ[n]; n++)
+		;
+
+	if (!(env = calloc(HOOK_VARS + n + 1, sizeof(char *))))
+	{
+		return NULL;
+	}
+
+	for (i = 0; i < HOOK_VARS && j->env[i]; i++)
+	{
+		env[i] = j->env[i];
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		if (strncmp(environ[k], "SYNODL_", 7))
+		{
+			env[i++] = environ[k];
+		}
+	}
+
+	return env;
+}
+
+/*
+ * Keeps our descriptors (the connections to the NAS, the transfer log ...)
+ * from the command. Without closefrom, they are marked close-on-exec, as
+ * far as we can tell which are open.
+ */
+static void
+close_fds(posix_spawn_file_actions_t *fa)
+{
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np(fa, 3);
+#else
+	struct dirent *d;
+	DIR *dh;
+	int fd;
+
+	if (!(dh = opendir("/proc/self/fd")))
+	{
+		return;
+	}
+
+	while ((d = readdir(dh)))
+	{
+		if ((fd = atoi(d->d_name)) > 2 && fd != dirfd(dh))
+		{
+			fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+		}
+	}
+
+	closedir(dh);
+#endif
+}
+
+static void
+run(struct job *j)
+{
+	char *argv[] = { "sh", "-c", policy.cmd[j->type], NULL };
+	posix_spawn_file_actions_t fa;
+	char **env;
+	pid_t pid;
+	int status;
+
+	if (!(env = make_env(j)))
+	{
+		return;
+	}
+
+	/* not onto the screen, stdout goes where error messages go */
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&fa, 2, 1);
+	close_fds(&fa);
+
+	if (posix_spawn(&pid, "/bin/sh", &fa, NULL, argv, env) == 0)
+	{
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+	}
+	else
+	{
+		fprintf(stderr, "Failed to run the %s hook\n",
+							event_names[j->type]);
+	}
+
+	posix_spawn_file_actions_destroy(&fa);
+	free(env);
+}
+
+static void *
+work(void *arg)
+{
+	struct job *j;
+
+	pthread_mutex_lock(&lock);
+
+	while (running)
+	{
+		if (!(j = queue))
+		{
+			pthread_cond_wait(&wakeup, &lock);
+			continue;
+		}
+
+		if (!(queue = j->next))
+		{
+			tail = &queue;
+		}
+
+		queued--;
+
+		pthread_mutex_unlock(&lock);
+		run(j);
+		free_job(j);
+		pthread_mutex_lock(&lock);
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int
+hooks_start(const struct hook_policy *p)
+{
+	int i;
+
+	memcpy(&policy, p, sizeof(struct hook_policy));
+
+	if (!hooks_enabled())
+	{
+		return 0;
+	}
+
+	running = 1;
+	nworkers = 0;
+
+	for (i = 0; i < policy.workers && i < HOOKS_WORKERS_MAX; i++)
+	{
+		if (pthread_create(&workers[i], NULL, work, NULL) != 0)
+		{
+			fprintf(stderr, "Failed to start worker thread\n");
+			hooks_stop();
+			return 1;
+		}
+
+		nworkers++;
+	}
+
+	return 0;
+}
+
+/* drops the commands that have not started, does not wait for the others */
+void
+hooks_stop()
+{
+	struct job *j;
+	int i;
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_broadcast(&wakeup);
+
+	while ((j = queue))
+	{
+		queue = j->next;
+		free_job(j);
+	}
+
+	tail = &queue;
+	queued = 0;
+	pthread_mutex_unlock(&lock);
+
+	/* each one goes once its command is done, or with us */
+	for (i = 0; i < nworkers; i++)
+	{
+		pthread_detach(workers[i]);
+	}
+
+	nworkers = 0;
+}
+
+int
+hooks_enabled()
+{
+	int i;
+
+	for (i = 0; i < EVENTS; i++)
+	{
+		if (strcmp(policy.cmd[i], ""))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+add_var(struct job *j, int *n, const char *name, const char *fmt, ...)
+{
+	va_list ap;
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "SYNODL_%s=", name);
+
+	va_start(ap, fmt);
+	vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	va_end(ap);
+
+	if (!(j->env[*n] = strdup(buf)))
+	{
+		return 1;
+	}
+
+	(*n)++;
+	return 0;
+}
+
+/*
+ * Queues the command for an event, if there is one. Returns 1 if it had to
+ * be dropped.
+ */
+int
+hooks_fire(enum event_type type, const char *nas, const struct task *old,
+						const struct task *cur)
+{
+	const struct task *t;
+	struct job *j;
+	int n, res;
+
+	if (!strcmp(policy.cmd[type], ""))
+	{
+		return 0;
+	}
+
+	if (!(j = calloc(1, sizeof(struct job))))
+	{
+		return 1;
+	}
+
+	t = cur ? cur : old;
+	j->type = type;
+	n = 0;
+
+	res = add_var(j, &n, "EVENT", "%s", event_names[type]) ||
+		add_var(j, &n, "NAS", "%s", nas) ||
+		add_var(j, &n, "ID", "%s", t->id) ||
+		add_var(j, &n, "TITLE", "%s", t->fn) ||
+		add_var(j, &n, "TYPE", "%s", t->type) ||
+		add_var(j, &n, "STATUS", "%s", cur ? cur->status : "") ||
+		add_var(j, &n, "OLD_STATUS", "%s", old ? old->status : "") ||
+		add_var(j, &n, "SIZE", "%" PRId64, t->size) ||
+		add_var(j, &n, "DOWNLOADED", "%" PRId64, t->downloaded) ||
+		add_var(j, &n, "UPLOADED", "%" PRId64, t->uploaded);
+
+	pthread_mutex_lock(&lock);
+
+	if (!running || res || queued >= HOOKS_QUEUE)
+	{
+		res = running;
+		pthread_mutex_unlock(&lock);
+		free_job(j);
+		return res;
+	}
+
+	*tail = j;
+	tail = &j->next;
+	queued++;
+
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_HOOKS_H
+#define __SYNODL_HOOKS_H
+
+#include "events.h"
+#include "syno.h"
+
+/* commands queued beyond this are dropped */
+#define HOOKS_QUEUE 256
+#define HOOKS_WORKERS_MAX 16
+
+/* a shell command per kind of event, "" for none */
+struct hook_policy
+{
+	char cmd[EVENTS][512];
+	int workers;	/* commands run at the same time */
+};
+
+int hooks_start(const struct hook_policy *policy);
+void hooks_stop();
+int hooks_enabled();
+int hooks_fire(enum event_type type, const char *nas, const struct task *old,
+						const struct task *cur);
+
+#endif
@@ -0,0 +1,545 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "cfg.h"
+#include "poller.h"
+#include "syno.h"
+
+/*
+	Simulated clients
+*/
+
+enum op
+{
+	OP_LOGIN,
+	OP_LIST,
+	OP_PAUSE,
+	OP_RESUME,
+	OP_LOGOUT,
+	OP_COUNT
+};
+
+static const char *op_names[] = { "login", "list", "pause", "resume",
+								"logout" };
+
+/* whose deadlines from the configuration file apply */
+static const enum syno_op op_kinds[] = { SYNO_OP_LOGIN, SYNO_OP_LIST,
+			SYNO_OP_TASK, SYNO_OP_TASK, SYNO_OP_LOGIN };
+
+struct buffer
+{
+	int size;
+	char *ptr;
+};
+
+struct client
+{
+	CURL *curl;
+	struct session *s;	/* only for the sid, the requests are ours */
+	struct buffer buf;
+	enum op op;
+	double started;
+	double next;
+	int busy;
+	int done;
+	char pick[16];
+	int seen;
+};
+
+struct op_stats
+{
+	int count;
+	int errors;
+	int64_t wire;
+	int64_t body;
+	int cap;
+	double *latency;
+};
+
+static struct op_stats stats[OP_COUNT];
+static const char *base;
+static const char *user;
+static const char *password;
+static struct cfg config;
+
+static double
+jitter(double interval)
+{
+	return interval * (0.5 + (double) rand() / RAND_MAX);
+}
+
+static void
+record(struct client *c, double latency, int failed)
+{
+	struct op_stats *st;
+	curl_off_t wire;
+	double *tmp;
+
+	st = &stats[c->op];
+
+	wire = 0;
+	curl_easy_getinfo(c->curl, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+	st->wire += wire;
+	st->body += c->buf.size;
+
+	if (st->count == st->cap)
+	{
+		st->cap = st->cap ? st->cap * 2 : 256;
+		tmp = realloc(st->latency, st->cap * sizeof(double));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			exit(EXIT_FAILURE);
+		}
+
+		st->latency = tmp;
+	}
+
+	st->latency[st->count++] = latency;
+	st->errors += failed;
+}
+
+static size_t
+client_recv(void *ptr, size_t size, size_t nmemb, struct buffer *b)
+{
+	char *tmp;
+
+	tmp = realloc(b->ptr, b->size + size * nmemb + 1);
+
+	if (!tmp)
+	{
+		fprintf(stderr, "Realloc failed\n");
+		return 0;
+	}
+
+	b->ptr = tmp;
+	memcpy(b->ptr + b->size, ptr, size * nmemb);
+	b->size += size * nmemb;
+	b->ptr[b->size] = 0;
+
+	return size * nmemb;
+}
+
+/* reservoir-samples one task id from the list we are parsing */
+static void
+pick_task(struct task *t, void *arg)
+{
+	struct client *c = arg;
+
+	c->seen += 1;
+
+	if (rand() % c->seen == 0)
+	{
+		snprintf(c->pick, sizeof(c->pick), "%s", t->id);
+	}
+}
+
+static void
+client_start(CURLM *multi, struct client *c, enum op op)
+{
+	char url[1024];
+
+	switch (op)
+	{
+	case OP_LOGIN:
+		syno_login_url(url, sizeof(url), base, user, password);
+		break;
+	case OP_LIST:
+		syno_list_url(url, sizeof(url), base, c->s);
+		break;
+	case OP_PAUSE:
+		syno_task_url(url, sizeof(url), base, c->s, "pause", c->pick);
+		break;
+	case OP_RESUME:
+		syno_task_url(url, sizeof(url), base, c->s, "resume",
+								c->pick);
+		break;
+	default:
+		syno_logout_url(url, sizeof(url), base, c->s);
+		break;
+	}
+
+	c->buf.size = 0;
+	c->op = op;
+	c->busy = 1;
+	c->started = now_ms() / 1000;
+
+	/* a request the NAS never answers must not keep us from reporting */
+	curl_easy_setopt(c->curl, CURLOPT_URL, url);
+	curl_easy_setopt(c->curl, CURLOPT_CONNECTTIMEOUT_MS,
+				(long) config.connect_timeout[op_kinds[op]]);
+	curl_easy_setopt(c->curl, CURLOPT_TIMEOUT_MS,
+				(long) config.timeout[op_kinds[op]]);
+	curl_multi_add_handle(multi, c->curl);
+}
+
+static void
+client_finish(struct client *c, CURLcode res, double interval, int percent)
+{
+	long code;
+	int failed;
+
+	c->busy = 0;
+	code = 0;
+	failed = (res != CURLE_OK);
+
+	if (!failed)
+	{
+		curl_easy_getinfo(c->curl, CURLINFO_RESPONSE_CODE, &code);
+		failed = (code != 200) || (c->buf.size == 0);
+	}
+
+	if (!failed)
+	{
+		switch (c->op)
+		{
+		case OP_LOGIN:
+			syno_parse_login(c->buf.ptr, c->buf.size + 1, c->s);
+			failed = !strcmp(syno_sid(c->s), "");
+			break;
+		case OP_LIST:
+			c->seen = 0;
+			c->pick[0] = 0;
+			failed = syno_parse_tasks(c->buf.ptr, c->buf.size + 1,
+								pick_task, c);
+			break;
+		default:
+			failed = syno_parse_reply(c->buf.ptr, c->buf.size + 1);
+			break;
+		}
+	}
+
+	record(c, now_ms() / 1000 - c->started, failed);
+
+	if (c->op == OP_LOGOUT)
+	{
+		c->done = 1;
+	}
+	else if (c->op == OP_LOGIN && failed)
+	{
+		/* no point hammering on without a session */
+		c->done = 1;
+	}
+	else if (c->op == OP_LIST && !failed && c->pick[0] &&
+						(rand() % 100) < percent)
+	{
+		c->next = now_ms() / 1000;
+		c->op = (rand() % 2) ? OP_PAUSE : OP_RESUME;
+	}
+	else
+	{
+		c->next = now_ms() / 1000 + jitter(interval);
+		c->op = OP_LIST;
+	}
+}
+
+/*
+	Report
+*/
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+percentile(struct op_stats *st, double p)
+{
+	int idx;
+
+	idx = (int) (p * (st->count - 1) + 0.5);
+	return st->latency[idx] * 1000;
+}
+
+static void
+report(double elapsed, int clients)
+{
+	struct op_stats *st;
+	int i, total, errors;
+	int64_t wire, body;
+
+	total = 0;
+	errors = 0;
+	wire = 0;
+	body = 0;
+
+	printf("\n%d clients, %.1f seconds\n\n", clients, elapsed);
+	printf("%-8s %8s %8s %8s %8s %8s %8s %8s\n", "op", "count", "errors",
+				"err%", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+	for (i = 0; i < OP_COUNT; i++)
+	{
+		st = &stats[i];
+
+		if (st->count == 0)
+		{
+			continue;
+		}
+
+		qsort(st->latency, st->count, sizeof(double), cmp_double);
+
+		printf("%-8s %8d %8d %7.1f%% %8.1f %8.1f %8.1f %8.1f\n",
+			op_names[i], st->count, st->errors,
+			100.0 * st->errors / st->count,
+			percentile(st, 0.5), percentile(st, 0.9),
+			percentile(st, 0.99), percentile(st, 1.0));
+
+		total += st->count;
+		errors += st->errors;
+		wire += st->wire;
+		body += st->body;
+	}
+
+	printf("\nthroughput: %.1f requests/s, %.1f errors/s\n",
+				total / elapsed, errors / elapsed);
+
+	st = &stats[OP_LIST];
+
+	if (st->count > 0 && st->body > 0)
+	{
+		printf("bytes per list: %" PRId64 " on the wire, %" PRId64
+			" decoded (%.0f%%)\n", st->wire / st->count,
+			st->body / st->count, 100.0 * st->wire / st->body);
+	}
+
+	printf("received: %.1f kB/s on the wire, %.1f kB/s decoded\n",
+				wire / elapsed / 1024, body / elapsed / 1024);
+}
+
+/*
+	Main
+*/
+
+static void
+help()
+{
+	printf("Syntax: synodl-load [options]\n\n");
+	printf("Simulates concurrent DownloadStation clients and reports\n");
+	printf("the latency and throughput the API sustains.\n\n");
+	printf("  -c CLIENTS   Number of simulated clients (default 10)\n");
+	printf("  -t SECONDS   Test duration (default 30)\n");
+	printf("  -i MSEC      Mean interval between list calls (default 1000)\n");
+	printf("  -p PERCENT   Chance of pause/resume after a list (default 20)\n");
+	printf("  -u URL       Override the URL from the configuration file\n");
+	printf("  -m           Let clients share multiplexed HTTP/2 connections\n");
+	printf("  -h           Show this help\n");
+	printf("\n");
+	printf("This is %s.\n", PACKAGE_STRING);
+	printf("Report bugs at https://github.com/cockroach/synodl/\n");
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, nclients, duration, interval, percent, running, msgs, mux;
+	int transfers;
+	double start, deadline, t;
+	const char *url;
+	struct client *clients, *cl;
+	CURLM *multi;
+	CURLMsg *msg;
+
+	nclients = 10;
+	duration = 30;
+	interval = 1000;
+	percent = 20;
+	mux = 0;
+	url = NULL;
+
+	memset(&config, 0, sizeof(struct cfg));
+
+	while ((c = getopt(argc, argv, "c:t:i:p:u:mh")) >= 0)
+	{
+		switch (c)
+		{
+		case 'c':
+			nclients = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'p':
+			percent = atoi(optarg);
+			break;
+		case 'u':
+			url = optarg;
+			break;
+		case 'm':
+			mux = 1;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		default:
+			help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (nclients < 1 || duration < 1 || interval < 1)
+	{
+		help();
+		return EXIT_FAILURE;
+	}
+
+	if (load_config(&config) != 0)
+	{
+		fprintf(stderr, "Failed to load configuration\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the first DiskStation in the configuration file */
+	base = url ? url : config.nas[0].url;
+	user = config.nas[0].user;
+	password = config.nas[0].pw;
+
+	clients = calloc(nclients, sizeof(struct client));
+
+	if (!clients)
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return EXIT_FAILURE;
+	}
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	multi = curl_multi_init();
+
+	/* real clients would not share a connection unless asked to */
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING,
+				mux ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	srand(time(NULL));
+
+	start = now_ms() / 1000;
+	deadline = start + duration;
+
+	for (i = 0; i < nclients; i++)
+	{
+		if (!(clients[i].s = syno_new()))
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* spread the logins over the first interval */
+	for (i = 0; i < nclients; i++)
+	{
+		cl = &clients[i];
+		cl->curl = curl_easy_init();
+		cl->op = OP_LOGIN;
+		cl->next = start + (double) interval / 1000 * i / nclients;
+
+		syno_setup_handle(cl->curl);
+		curl_easy_setopt(cl->curl, CURLOPT_WRITEFUNCTION, client_recv);
+		curl_easy_setopt(cl->curl, CURLOPT_WRITEDATA, &cl->buf);
+		curl_easy_setopt(cl->curl, CURLOPT_PRIVATE, cl);
+	}
+
+	printf("Running %d clients against %s for %d seconds...\n", nclients,
+								base, duration);
+
+	do
+	{
+		t = now_ms() / 1000;
+		running = 0;
+
+		for (i = 0; i < nclients; i++)
+		{
+			cl = &clients[i];
+
+			if (cl->done)
+			{
+				continue;
+			}
+
+			running += 1;
+
+			if (cl->busy || cl->next > t)
+			{
+				continue;
+			}
+
+			if (t >= deadline)
+			{
+				if (!strcmp(syno_sid(cl->s), ""))
+				{
+					cl->done = 1;
+					continue;
+				}
+
+				cl->op = OP_LOGOUT;
+			}
+
+			client_start(multi, cl, cl->op);
+		}
+
+		curl_multi_perform(multi, &transfers);
+		curl_multi_wait(multi, NULL, 0, 10, NULL);
+		curl_multi_perform(multi, &transfers);
+
+		while ((msg = curl_multi_info_read(multi, &msgs)))
+		{
+			if (msg->msg != CURLMSG_DONE)
+			{
+				continue;
+			}
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+							(char **) &cl);
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			client_finish(cl, msg->data.result, interval / 1000.0,
+								percent);
+		}
+	} while (running > 0);
+
+	report(now_ms() / 1000 - start, nclients);
+
+	for (i = 0; i < nclients; i++)
+	{
+		curl_easy_cleanup(clients[i].curl);
+		syno_free(clients[i].s);
+		free(clients[i].buf.ptr);
+	}
+
+	for (i = 0; i < OP_COUNT; i++)
+	{
+		free(stats[i].latency);
+	}
+
+	curl_multi_cleanup(multi);
+	curl_global_cleanup();
+	free(clients);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,703 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+
+#include "cfg.h"
+#include "nas.h"
+#include "schedule.h"
+#include "syno.h"
+
+/*
+ * Every DiskStation has a thread of its own that logs in, fetches the task
+ * list when the main thread asks for it and runs the statistics heartbeat
+ * in between. A slow or unreachable box only ever holds up its own thread;
+ * the main thread picks up whatever lists are ready.
+ *
+ * All threads talking to a box share its sid. When the server drops it,
+ * whichever thread notices first logs in again and the others pick up
+ * the new sid (see relogin()).
+ */
+
+/* ms between login attempts while a box is unreachable */
+#define NAS_RETRY 10000
+
+struct nas
+{
+	struct cfg_nas *cfg;
+	struct session *s;	/* the worker's own */
+	pthread_t thread;
+	pthread_cond_t wakeup;
+	enum nas_state state;
+	char sid[24];		/* for the sessions of other threads */
+	int renewing;		/* somebody is logging in again */
+	int heartbeat;		/* ms, 0 if off or not supported */
+	int beat_wait;		/* ms, longer while the heartbeat fails */
+
+	/* requests from the main thread */
+	int refresh;
+	int forget;
+	int cancel;
+
+	/* the list being fetched */
+	int fetching;
+	int64_t bytes;
+	double elapsed;
+	struct task *fetched;
+	int fetched_len;
+	int fetched_cap;
+	int fetch_failed;	/* some tasks did not fit in */
+
+	/* the last list and what it took to fetch it */
+	struct task *tasks;
+	int n;
+	int cap;
+	int res;
+	int ready;
+	struct syno_stats stats;
+
+	/* the last statistics */
+	int up;
+	int dn;
+	int beat;
+
+	/* speed limits to set, KB/s or -1, and how that went */
+	int limit_dn;
+	int limit_up;
+	int limits;	/* yet to be set */
+	int limits_retry;	/* after the next list, the box was unreachable */
+	int limits_done;
+	int limits_error;
+	struct schedule_limits saved;	/* touched by the thread only */
+};
+
+static struct nas nas[CFG_NAS_MAX];
+static struct cfg *run_config;	/* for the sessions of other threads */
+static int count, running;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t login = PTHREAD_COND_INITIALIZER;
+
+static void
+fetch_task(struct task *t, void *arg)
+{
+	struct nas *n = arg;
+	struct task *tmp;
+	int cap;
+
+	if (n->fetched_len == n->fetched_cap)
+	{
+		cap = n->fetched_cap ? n->fetched_cap * 2 : 256;
+		tmp = realloc(n->fetched, cap * sizeof(struct task));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			n->fetch_failed = 1;
+			return;
+		}
+
+		n->fetched = tmp;
+		n->fetched_cap = cap;
+	}
+
+	memcpy(&n->fetched[n->fetched_len++], t, sizeof(struct task));
+}
+
+static void
+wait_ms(struct nas *n, int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+
+	if (ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait(&n->wakeup, &lock, &ts);
+}
+
+/*
+ * Called by the syno_* functions when the server has forgotten the sid of
+ * s, a session for NAS n. Returns 0 once s has a working one again.
+ */
+static int
+relogin(struct session *s, void *arg)
+{
+	struct nas *n = arg;
+	int res;
+
+	pthread_mutex_lock(&lock);
+
+	while (n->renewing)
+	{
+		pthread_cond_wait(&login, &lock);
+	}
+
+	/* somebody else got there first */
+	if (strcmp(syno_sid(s), n->sid) != 0)
+	{
+		syno_set_sid(s, n->sid);
+		res = n->state != NAS_ONLINE;
+		pthread_mutex_unlock(&lock);
+		return res;
+	}
+
+	n->renewing = 1;
+	pthread_mutex_unlock(&lock);
+
+	res = syno_login(n->cfg->url, s, n->cfg->user, n->cfg->pw);
+
+	pthread_mutex_lock(&lock);
+	n->renewing = 0;
+	n->state = res ? NAS_OFFLINE : NAS_ONLINE;
+	snprintf(n->sid, sizeof(n->sid), "%s", syno_sid(s));
+	pthread_cond_broadcast(&login);
+
+	/* if that did not work, the NAS thread keeps trying */
+	pthread_cond_signal(&n->wakeup);
+	pthread_mutex_unlock(&lock);
+
+	return res;
+}
+
+/* keeps track of the list request, and gives up on it if asked to */
+static int
+progress(void *arg, int64_t bytes, double elapsed)
+{
+	struct nas *n = arg;
+	int stop;
+
+	pthread_mutex_lock(&lock);
+
+	if (n->fetching)
+	{
+		n->bytes = bytes;
+		n->elapsed = elapsed;
+	}
+
+	stop = !running || (n->fetching && n->cancel);
+	pthread_mutex_unlock(&lock);
+
+	return stop;
+}
+
+/* called with the lock held, returns with it held */
+static void
+sign_in(struct nas *n)
+{
+	int res;
+
+	while (running && n->state != NAS_ONLINE)
+	{
+		if (n->renewing)
+		{
+			pthread_cond_wait(&login, &lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&lock);
+		res = syno_login(n->cfg->url, n->s, n->cfg->user, n->cfg->pw);
+		pthread_mutex_lock(&lock);
+
+		n->state = res ? NAS_OFFLINE : NAS_ONLINE;
+		snprintf(n->sid, sizeof(n->sid), "%s", syno_sid(n->s));
+		pthread_cond_broadcast(&login);
+
+		if (res)
+		{
+			wait_ms(n, NAS_RETRY);
+		}
+	}
+}
+
+static void
+refresh(struct nas *n)
+{
+	struct task *tmp;
+	int res, cap;
+
+	n->refresh = 0;
+
+	if (n->forget)
+	{
+		syno_forget(n->s);
+		n->forget = 0;
+	}
+
+	n->fetched_len = 0;
+	n->fetch_failed = 0;
+
+	/* another thread might have logged in again meanwhile */
+	syno_set_sid(n->s, n->sid);
+
+	n->fetching = 1;
+	n->cancel = 0;
+	n->bytes = 0;
+	n->elapsed = 0;
+
+	pthread_mutex_unlock(&lock);
+	res = syno_list(n->cfg->url, n->s, fetch_task, n);
+	pthread_mutex_lock(&lock);
+
+	syno_stats(n->s, &n->stats);
+
+	/* a partial list would have the rest taken for deleted */
+	if (res == 0 && n->fetch_failed)
+	{
+		res = 1;
+		n->stats.error = -CURLE_OUT_OF_MEMORY;
+	}
+
+	n->fetching = 0;
+	n->cancel = 0;
+
+	if (n->limits_retry && res == 0)
+	{
+		n->limits_retry = 0;
+		n->limits = 1;
+	}
+
+	/* hand the list over, keeping the old buffer for the next one */
+	tmp = n->tasks;
+	n->tasks = n->fetched;
+	n->fetched = tmp;
+
+	cap = n->cap;
+	n->cap = n->fetched_cap;
+	n->fetched_cap = cap;
+
+	n->n = n->fetched_len;
+	n->fetched_len = 0;
+
+	n->res = res;
+	n->ready = 1;
+}
+
+static void
+set_limits(struct nas *n)
+{
+	int res, dn, up;
+
+	n->limits = 0;
+	dn = n->limit_dn;
+	up = n->limit_up;
+	syno_set_sid(n->s, n->sid);
+
+	pthread_mutex_unlock(&lock);
+	res = schedule_limits(&n->saved, n->cfg->url, n->s, dn, up);
+	pthread_mutex_lock(&lock);
+
+	/* newer ones came in meanwhile */
+	if (n->limits)
+	{
+		return;
+	}
+
+	n->limits_retry = res != 0 && syno_error(n->s) < 0;
+	n->limits_done = !n->limits_retry;
+	n->limits_error = res ? syno_error(n->s) : 0;
+}
+
+/* the NAS does not know the statistics API at all */
+static int
+unsupported(int error)
+{
+	return error == 102 || error == 103 || error == 104;
+}
+
+static void
+heartbeat(struct nas *n)
+{
+	int res, up, dn, max;
+
+	syno_set_sid(n->s, n->sid);
+
+	pthread_mutex_unlock(&lock);
+	res = syno_statistic(n->cfg->url, n->s, &up, &dn);
+	pthread_mutex_lock(&lock);
+
+	/* refused: not supported, leave it to the list */
+	if (res != 0 && unsupported(syno_error(n->s)))
+	{
+		n->heartbeat = 0;
+	}
+
+	/* anything else might pass later, ask less often meanwhile */
+	if (res != 0)
+	{
+		max = n->heartbeat > NAS_RETRY ? n->heartbeat : NAS_RETRY;
+		n->beat_wait = n->beat_wait * 2 < max ? n->beat_wait * 2 : max;
+		return;
+	}
+
+	n->beat_wait = n->heartbeat;
+	n->up = up;
+	n->dn = dn;
+	n->beat = 1;
+}
+
+static void *
+work(void *arg)
+{
+	struct nas *n = arg;
+
+	pthread_mutex_lock(&lock);
+
+	while (running)
+	{
+		/* at first, and whenever logging in again has failed */
+		if (n->state != NAS_ONLINE)
+		{
+			sign_in(n);
+			continue;
+		}
+
+		if (n->refresh)
+		{
+			refresh(n);
+			continue;
+		}
+
+		if (n->limits)
+		{
+			set_limits(n);
+			continue;
+		}
+
+		if (n->heartbeat)
+		{
+			wait_ms(n, n->beat_wait);
+
+			if (running && !n->refresh && n->heartbeat)
+			{
+				heartbeat(n);
+			}
+		}
+		else
+		{
+			pthread_cond_wait(&n->wakeup, &lock);
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* logs in to all configured DiskStations in the background */
+int
+nas_start(struct cfg *config)
+{
+	int i;
+
+	run_config = config;
+	running = 1;
+	count = 0;
+
+	for (i = 0; i < config->nas_count; i++)
+	{
+		memset(&nas[i], 0, sizeof(struct nas));
+		nas[i].cfg = &config->nas[i];
+		nas[i].heartbeat = config->heartbeat;
+		nas[i].beat_wait = config->heartbeat;
+		nas[i].state = NAS_CONNECTING;
+
+		if (!(nas[i].s = config_session(config)))
+		{
+			nas_stop();
+			return 1;
+		}
+
+		syno_set_relogin(nas[i].s, relogin, &nas[i]);
+		syno_set_progress(nas[i].s, progress, &nas[i]);
+		pthread_cond_init(&nas[i].wakeup, NULL);
+
+		if (pthread_create(&nas[i].thread, NULL, work, &nas[i]) != 0)
+		{
+			fprintf(stderr, "Failed to start worker thread\n");
+			pthread_cond_destroy(&nas[i].wakeup);
+			syno_free(nas[i].s);
+			nas_stop();
+			return 1;
+		}
+
+		count += 1;
+	}
+
+	return 0;
+}
+
+void
+nas_stop()
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		pthread_cond_signal(&nas[i].wakeup);
+	}
+
+	pthread_cond_broadcast(&login);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < count; i++)
+	{
+		pthread_join(nas[i].thread, NULL);
+
+		/* no longer cut short now that we are stopping */
+		syno_set_progress(nas[i].s, NULL, NULL);
+
+		if (nas[i].state == NAS_ONLINE)
+		{
+			/* what a schedule window changed goes back as it was */
+			schedule_limits(&nas[i].saved, nas[i].cfg->url,
+							nas[i].s, -1, -1);
+			syno_logout(nas[i].cfg->url, nas[i].s);
+		}
+
+		syno_free(nas[i].s);
+		pthread_cond_destroy(&nas[i].wakeup);
+		free(nas[i].tasks);
+		free(nas[i].fetched);
+	}
+
+	count = 0;
+}
+
+int
+nas_count()
+{
+	return count;
+}
+
+const char *
+nas_name(int i)
+{
+	return nas[i].cfg->name;
+}
+
+const char *
+nas_url(int i)
+{
+	return nas[i].cfg->url;
+}
+
+enum nas_state
+nas_state(int i)
+{
+	enum nas_state state;
+
+	pthread_mutex_lock(&lock);
+	state = nas[i].state;
+	pthread_mutex_unlock(&lock);
+
+	return state;
+}
+
+/*
+ * Gets a session of another thread ready for requests to NAS i, waiting
+ * for the login if need be. *s is made on first use and released by the
+ * caller with syno_free(). Returns 1 if the NAS is not available. The
+ * session logs in again by itself should the sid expire.
+ */
+int
+nas_session(int i, struct session **s)
+{
+	int res;
+
+	if (!*s && !(*s = config_session(run_config)))
+	{
+		return 1;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	while (running && nas[i].state == NAS_CONNECTING)
+	{
+		pthread_cond_wait(&login, &lock);
+	}
+
+	res = nas[i].state != NAS_ONLINE;
+	syno_set_sid(*s, nas[i].sid);
+	syno_set_relogin(*s, relogin, &nas[i]);
+
+	pthread_mutex_unlock(&lock);
+	return res;
+}
+
+/* asks for a fresh task list, forget drops the conditional request state */
+void
+nas_refresh(int i, int forget)
+{
+	pthread_mutex_lock(&lock);
+	nas[i].refresh = 1;
+	nas[i].forget |= forget;
+	pthread_cond_signal(&nas[i].wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Whether a list has been asked for and not collected yet. A NAS that is
+ * not online does not count until it is, asking it does not hurry it.
+ */
+int
+nas_busy(int i)
+{
+	int busy;
+
+	pthread_mutex_lock(&lock);
+	busy = nas[i].ready || (nas[i].state == NAS_ONLINE &&
+				(nas[i].refresh || nas[i].fetching));
+	pthread_mutex_unlock(&lock);
+
+	return busy;
+}
+
+/*
+ * Feeds the last list fetched from NAS i to cb, along with arg, and returns
+ * what syno_list() did, or -1 if there is no new list. The transfer
+ * statistics of the request go to stats.
+ */
+int
+nas_collect(int i, void (*cb)(struct task *t, void *arg), void *arg,
+						struct syno_stats *stats)
+{
+	int k, res;
+
+	pthread_mutex_lock(&lock);
+
+	if (!nas[i].ready)
+	{
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	if (nas[i].res == 0)
+	{
+		for (k = 0; k < nas[i].n; k++)
+		{
+			cb(&nas[i].tasks[k], arg);
+		}
+	}
+
+	memcpy(stats, &nas[i].stats, sizeof(struct syno_stats));
+
+	res = nas[i].res;
+	nas[i].ready = 0;
+
+	pthread_mutex_unlock(&lock);
+	return res;
+}
+
+/*
+ * Returns 1 if a list is being fetched from NAS i, and how much of it has
+ * come in so far.
+ */
+int
+nas_progress(int i, int64_t *bytes, double *elapsed)
+{
+	int fetching;
+
+	pthread_mutex_lock(&lock);
+
+	fetching = nas[i].fetching;
+	*bytes = nas[i].bytes;
+	*elapsed = nas[i].elapsed;
+
+	pthread_mutex_unlock(&lock);
+	return fetching;
+}
+
+/* gives up on the list being fetched, the last one stays as it is */
+int
+nas_cancel(int i)
+{
+	int fetching;
+
+	pthread_mutex_lock(&lock);
+
+	if ((fetching = nas[i].fetching))
+	{
+		nas[i].cancel = 1;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return fetching;
+}
+
+/* sets the speed limits of NAS i in the background, see schedule_limits() */
+void
+nas_limits(int i, int dn, int up)
+{
+	pthread_mutex_lock(&lock);
+	nas[i].limit_dn = dn;
+	nas[i].limit_up = up;
+	nas[i].limits = 1;
+	nas[i].limits_retry = 0;
+	nas[i].limits_done = 0;
+	pthread_cond_signal(&nas[i].wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+/* returns 1 and the error (or 0) once the limits have been set */
+int
+nas_limits_done(int i, int *error)
+{
+	int done;
+
+	pthread_mutex_lock(&lock);
+
+	done = nas[i].limits_done;
+	*error = nas[i].limits_error;
+	nas[i].limits_done = 0;
+
+	pthread_mutex_unlock(&lock);
+	return done;
+}
+
+/* returns 1 and the speeds if a heartbeat came in since the last call */
+int
+nas_beat(int i, int *up, int *dn)
+{
+	int beat;
+
+	pthread_mutex_lock(&lock);
+
+	beat = nas[i].beat;
+	*up = nas[i].up;
+	*dn = nas[i].dn;
+	nas[i].beat = 0;
+
+	pthread_mutex_unlock(&lock);
+	return beat;
+}
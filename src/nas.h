@@ -0,0 +1,52 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_NAS_H
+#define __SYNODL_NAS_H
+
+#include "cfg.h"
+#include "syno.h"
+
+enum nas_state
+{
+	NAS_CONNECTING,
+	NAS_ONLINE,
+	NAS_OFFLINE
+};
+
+int nas_start(struct cfg *config);
+void nas_stop();
+int nas_count();
+const char *nas_name(int i);
+const char *nas_url(int i);
+enum nas_state nas_state(int i);
+int nas_session(int i, struct session **s);
+
+void nas_refresh(int i, int forget);
+int nas_busy(int i);
+int nas_collect(int i, void (*cb)(struct task *t, void *arg), void *arg,
+						struct syno_stats *stats);
+int nas_beat(int i, int *up, int *dn);
+int nas_progress(int i, int64_t *bytes, double *elapsed);
+int nas_cancel(int i);
+void nas_limits(int i, int dn, int up);
+int nas_limits_done(int i, int *error);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <time.h>
+
+#include "poller.h"
+
+/* milliseconds on a clock that only ever goes forward */
+double
+now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* never keep the NAS busy for more than 1/LOAD_FACTOR of the time */
+#define LOAD_FACTOR 10
+
+static void
+clamp(struct poller *p)
+{
+	if (p->interval < p->min)
+	{
+		p->interval = p->min;
+	}
+	if (p->interval > p->max)
+	{
+		p->interval = p->max;
+	}
+}
+
+void
+poller_init(struct poller *p, int min, int max)
+{
+	p->min = min;
+	p->max = max > min ? max : min;
+	p->interval = p->min;
+	p->latency = 0;
+}
+
+/* the user is looking at the list, so keep it fresh */
+void
+poller_interact(struct poller *p)
+{
+	p->interval = p->min;
+}
+
+/*
+ * Feeds back the outcome of a refresh and returns the time to wait before
+ * the next one: as fast as allowed while something is moving, doubling
+ * while nothing changes, and never faster than the server can comfortably
+ * answer.
+ */
+int
+poller_update(struct poller *p, int changed, int active, double latency)
+{
+	int floor;
+
+	if (p->latency == 0)
+	{
+		p->latency = latency;
+	}
+	else
+	{
+		p->latency = 0.7 * p->latency + 0.3 * latency;
+	}
+
+	if (active)
+	{
+		p->interval = p->min;
+	}
+	else if (changed)
+	{
+		p->interval /= 2;
+	}
+	else
+	{
+		p->interval *= 2;
+	}
+
+	floor = p->latency * LOAD_FACTOR;
+
+	if (p->interval < floor)
+	{
+		p->interval = floor;
+	}
+
+	clamp(p);
+	return p->interval;
+}
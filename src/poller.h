@@ -0,0 +1,39 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_POLLER_H
+#define __SYNODL_POLLER_H
+
+/* all times in milliseconds */
+struct poller
+{
+	int min;
+	int max;
+	int interval;
+	double latency;		/* smoothed server response time */
+};
+
+double now_ms();
+
+void poller_init(struct poller *p, int min, int max);
+void poller_interact(struct poller *p);
+int poller_update(struct poller *p, int changed, int active, double latency);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "queue.h"
+#include "tasks.h"
+
+/*
+ * Keeps a number of tasks downloading on each NAS, pausing the ones beyond
+ * that and resuming them, in order of their rank, as others finish. Only
+ * tasks it paused itself are ever resumed, what the user paused stays
+ * paused. To keep from flapping, it only pauses once the NAS is more than
+ * `slack' tasks over the limit and leaves a task it switched alone for a
+ * while.
+ *
+ * The tasks it has paused are kept in the state file, one "nas id" line
+ * each in the order they are to be resumed, so that the next run can tell
+ * them from those the user paused.
+ */
+
+/* ranks of the tasks paused in an earlier run, ahead of all others */
+#define ADOPTED (INT_MIN / 2)
+
+struct saved
+{
+	int nas;	/* -1 once the task has been seen */
+	char id[16];
+};
+
+static struct queue_policy policy;
+
+/* reused between runs */
+static struct tasklist_ent **cands;
+static int cands_cap;
+
+/* read from the state file, and what we last wrote to it */
+static struct saved *saved;
+static int nsaved;
+static char *written;
+
+/* a task that takes up one of the slots */
+static int
+occupies(const char *status)
+{
+	return !strcmp(status, "downloading") || !strcmp(status, "waiting") ||
+				!strcmp(status, "hash_checking") ||
+				!strcmp(status, "filehosting_waiting");
+}
+
+static int
+by_rank(const void *pa, const void *pb)
+{
+	const struct tasklist_ent *a, *b;
+
+	a = *(const struct tasklist_ent **) pa;
+	b = *(const struct tasklist_ent **) pb;
+
+	return a->rank < b->rank ? -1 : a->rank > b->rank;
+}
+
+static int
+add_cand(struct tasklist_ent *ent, int n)
+{
+	struct tasklist_ent **tmp;
+	int cap;
+
+	if (n == cands_cap)
+	{
+		cap = cands_cap ? cands_cap * 2 : 64;
+
+		if (!(tmp = realloc(cands, cap * sizeof(*cands))))
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return n;
+		}
+
+		cands = tmp;
+		cands_cap = cap;
+	}
+
+	cands[n] = ent;
+	return n + 1;
+}
+
+/* the file as queue_save() would write it, to be freed by the caller */
+static char *
+state_text()
+{
+	struct tasklist_ent *ent;
+	char *buf;
+	int i, n, len, size;
+
+	n = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->queued)
+		{
+			n = add_cand(ent, n);
+		}
+	}
+
+	qsort(cands, n, sizeof(*cands), by_rank);
+
+	size = (n + nsaved) * (sizeof(saved->id) + 16) + 1;
+
+	if (!(buf = malloc(size)))
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	buf[0] = 0;
+	len = 0;
+
+	/* those not seen yet stay ahead, where they were */
+	for (i = 0; i < nsaved; i++)
+	{
+		if (saved[i].nas >= 0)
+		{
+			len += snprintf(buf + len, size - len, "%d %s\n",
+						saved[i].nas, saved[i].id);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		len += snprintf(buf + len, size - len, "%d %s\n",
+						cands[i]->nas, cands[i]->t->id);
+	}
+
+	return buf;
+}
+
+static void
+load(const char *fn)
+{
+	struct saved *tmp, s;
+	FILE *fh;
+
+	if (!(fh = fopen(fn, "r")))
+	{
+		return;
+	}
+
+	while (fscanf(fh, "%d %15s", &s.nas, s.id) == 2)
+	{
+		if (!(tmp = realloc(saved, (nsaved + 1) * sizeof(*saved))))
+		{
+			fprintf(stderr, "Realloc failed\n");
+			break;
+		}
+
+		saved = tmp;
+		memcpy(&saved[nsaved++], &s, sizeof(struct saved));
+	}
+
+	fclose(fh);
+}
+
+void
+queue_init(const struct queue_policy *p)
+{
+	memcpy(&policy, p, sizeof(struct queue_policy));
+
+	if (strcmp(policy.state, ""))
+	{
+		load(policy.state);
+		written = state_text();
+	}
+}
+
+/*
+ * Writes the state file if the tasks paused by the queue manager or their
+ * order have changed since the last time.
+ */
+void
+queue_save()
+{
+	char tmp[sizeof(policy.state) + 8];
+	char *text;
+	FILE *fh;
+
+	if (!strcmp(policy.state, "") || !(text = state_text()))
+	{
+		return;
+	}
+
+	if (written && !strcmp(text, written))
+	{
+		free(text);
+		return;
+	}
+
+	free(written);
+	written = text;
+
+	if (!strcmp(text, ""))
+	{
+		if (unlink(policy.state) != 0 && errno != ENOENT)
+		{
+			perror(policy.state);
+		}
+
+		return;
+	}
+
+	/* a run cut short must not leave half a file */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", policy.state);
+
+	if (!(fh = fopen(tmp, "w")))
+	{
+		perror(tmp);
+		return;
+	}
+
+	fputs(text, fh);
+
+	if (fclose(fh) != 0 || rename(tmp, policy.state) != 0)
+	{
+		perror(policy.state);
+	}
+}
+
+/* tasks an earlier run paused are ours again once the list has them */
+static void
+adopt(int nas)
+{
+	struct tasklist_ent *ent;
+	int i;
+
+	for (i = 0; i < nsaved; i++)
+	{
+		if (saved[i].nas != nas || !(ent = tasks_find(nas, saved[i].id)))
+		{
+			continue;
+		}
+
+		if (!strcmp(ent->t->status, "paused"))
+		{
+			ent->queued = 1;
+			ent->rank = ADOPTED + i;
+			ent->dirty = 1;
+		}
+
+		saved[i].nas = -1;
+	}
+}
+
+/* e.g. for the schedule, 0 hands the queue back to DownloadStation */
+void
+queue_set_active(int active)
+{
+	policy.active = active;
+}
+
+/* resumes whatever is still queued once there is no limit any more */
+static int
+release(int nas, int (*submit)(struct tasklist_ent *, enum cmd_method))
+{
+	struct tasklist_ent *ent;
+	int sent;
+
+	sent = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->nas != nas || !ent->queued)
+		{
+			continue;
+		}
+
+		if (strcmp(ent->t->status, "paused"))
+		{
+			ent->queued = 0;
+			ent->dirty = 1;
+		}
+		else if (submit(ent, CMD_RESUME) == 0)
+		{
+			ent->switched = time(NULL);
+			sent++;
+		}
+	}
+
+	return sent;
+}
+
+/* switched too recently to be switched again */
+int
+queue_held(struct tasklist_ent *ent)
+{
+	return ent->switched && time(NULL) - ent->switched < policy.hold;
+}
+
+/*
+ * Compares the tasks on the NAS against the limit and hands whatever needs
+ * to be paused or resumed to submit(), which is expected to queue one
+ * command. Returns the number of commands submitted.
+ */
+int
+queue_run(int nas, int (*submit)(struct tasklist_ent *, enum cmd_method))
+{
+	struct tasklist_ent *ent;
+	enum cmd_method method;
+	int active, need, n, i, sent;
+
+	adopt(nas);
+
+	if (policy.active <= 0)
+	{
+		return release(nas, submit);
+	}
+
+	active = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->nas != nas)
+		{
+			continue;
+		}
+
+		/* resumed behind our back */
+		if (ent->queued && strcmp(ent->t->status, "paused"))
+		{
+			ent->queued = 0;
+			ent->dirty = 1;
+		}
+
+		active += occupies(ent->t->status);
+	}
+
+	if (active > policy.active + policy.slack)
+	{
+		method = CMD_PAUSE;
+		need = active - policy.active;
+	}
+	else if (active < policy.active)
+	{
+		method = CMD_RESUME;
+		need = policy.active - active;
+	}
+	else
+	{
+		return 0;
+	}
+
+	n = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->nas != nas || queue_held(ent))
+		{
+			continue;
+		}
+
+		if (method == CMD_PAUSE ? (!strcmp(ent->t->status, "downloading")
+				|| !strcmp(ent->t->status, "waiting")) :
+				ent->queued)
+		{
+			n = add_cand(ent, n);
+		}
+	}
+
+	qsort(cands, n, sizeof(*cands), by_rank);
+	sent = 0;
+
+	/* pause from the back, resume from the front */
+	for (i = 0; i < n && sent < need; i++)
+	{
+		ent = cands[method == CMD_PAUSE ? n - 1 - i : i];
+
+		if (submit(ent, method) != 0)
+		{
+			break;
+		}
+
+		ent->queued = method == CMD_PAUSE;
+		ent->switched = time(NULL);
+		sent++;
+	}
+
+	return sent;
+}
+
+int
+queue_enabled()
+{
+	return policy.active > 0;
+}
+
+/* puts the task behind all others, for the queue manager to resume last */
+void
+queue_to_back(struct tasklist_ent *ent)
+{
+	struct tasklist_ent *tmp;
+	int last;
+
+	last = ent->rank;
+
+	for (tmp = tasks; tmp; tmp = tmp->next)
+	{
+		if (tmp->nas == ent->nas && tmp->rank > last)
+		{
+			last = tmp->rank;
+		}
+	}
+
+	ent->rank = last + 1;
+}
+
+/* ... or ahead of them, to be resumed first and paused last */
+void
+queue_to_front(struct tasklist_ent *ent)
+{
+	struct tasklist_ent *tmp;
+	int first;
+
+	first = ent->rank;
+
+	for (tmp = tasks; tmp; tmp = tmp->next)
+	{
+		if (tmp->nas == ent->nas && tmp->rank < first)
+		{
+			first = tmp->rank;
+		}
+	}
+
+	ent->rank = first - 1;
+}
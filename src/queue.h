@@ -0,0 +1,46 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_QUEUE_H
+#define __SYNODL_QUEUE_H
+
+#include "cmd.h"
+#include "tasks.h"
+
+/* how many tasks to keep downloading per NAS, see queue_run() */
+struct queue_policy
+{
+	int active;	/* 0 leaves the queue to DownloadStation */
+	int slack;	/* tasks allowed over the limit before pausing */
+	int hold;	/* s a task is left alone after being switched */
+	char state[1024];	/* file of the tasks it paused, "" for none */
+};
+
+void queue_init(const struct queue_policy *policy);
+void queue_set_active(int active);
+int queue_run(int nas, int (*submit)(struct tasklist_ent *,
+							enum cmd_method));
+int queue_held(struct tasklist_ent *ent);
+int queue_enabled();
+void queue_to_back(struct tasklist_ent *ent);
+void queue_to_front(struct tasklist_ent *ent);
+void queue_save();
+
+#endif
@@ -0,0 +1,145 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "schedule.h"
+
+/*
+ * Which of the windows read by config_schedule() (see cfg.c) applies when,
+ * and what it changes on the NAS.
+ */
+
+/* the window that applies at that time, -1 if none does */
+int
+schedule_find(const struct schedule *sc, time_t now)
+{
+	const struct schedule_window *w;
+	struct tm tm;
+	int i, day, min, len, start;
+
+	localtime_r(&now, &tm);
+	min = tm.tm_wday * 1440 + tm.tm_hour * 60 + tm.tm_min;
+
+	for (i = 0; i < sc->n; i++)
+	{
+		w = &sc->w[i];
+		len = (w->end - w->start + 1440) % 1440;
+
+		/* 00:00-24:00 or 08:00-08:00 is all day */
+		if (len == 0)
+		{
+			len = 1440;
+		}
+
+		for (day = 0; day < 7; day++)
+		{
+			if (!(w->days & (1 << day)))
+			{
+				continue;
+			}
+
+			start = day * 1440 + w->start;
+
+			/* into the next week: sat 22:00-06:00 */
+			if ((min - start + 7 * 1440) % (7 * 1440) < len)
+			{
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * The settings of window i (-1 for outside all of them). What a window does
+ * not set is what applies outside: the usual number of active tasks and the
+ * speed limits of the NAS itself.
+ */
+void
+schedule_get(const struct schedule *sc, int i, int active,
+					struct schedule_window *w)
+{
+	const struct schedule_window *win;
+
+	memset(w, 0, sizeof(struct schedule_window));
+	snprintf(w->spec, sizeof(w->spec), "%s", i < 0 ? "default" :
+								sc->w[i].spec);
+	w->active = active;
+	w->dn = -1;
+	w->up = -1;
+
+	if (i < 0)
+	{
+		return;
+	}
+
+	win = &sc->w[i];
+
+	if (win->active >= 0)
+		w->active = win->active;
+	if (win->dn >= 0)
+		w->dn = win->dn;
+	if (win->up >= 0)
+		w->up = win->up;
+}
+
+/*
+ * Sets the speed limits of a window on the NAS, -1 keeping the NAS's own.
+ * Those are read before the first change and put back once no window
+ * changes them any more. Returns 0 on success, the error is in s.
+ */
+int
+schedule_limits(struct schedule_limits *sl, const char *base,
+					struct session *s, int dn, int up)
+{
+	int limits[SYNO_LIMITS];
+
+	if (dn < 0 && up < 0 && !sl->changed)
+	{
+		return 0;
+	}
+
+	if (!sl->changed && syno_get_limits(base, s, sl->saved) != 0)
+	{
+		return 1;
+	}
+
+	memcpy(limits, sl->saved, sizeof(limits));
+	syno_limits_apply(limits, dn, up);
+
+	if (syno_set_limits(base, s, limits) != 0)
+	{
+		return 1;
+	}
+
+	sl->changed = dn >= 0 || up >= 0;
+	return 0;
+}
+
+/* ms until the next minute, when a window might start or end */
+int
+schedule_wait(time_t now)
+{
+	return (60 - now % 60) * 1000;
+}
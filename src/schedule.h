@@ -0,0 +1,62 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_SCHEDULE_H
+#define __SYNODL_SCHEDULE_H
+
+#include <time.h>
+
+#include "syno.h"
+
+#define SCHEDULE_MAX 16
+
+/* a time of the week with limits of its own, from a "schedule" line */
+struct schedule_window
+{
+	char spec[64];	/* as given, for messages */
+	int days;	/* bit 0 for Sunday */
+	int start;	/* minutes into the day */
+	int end;	/* ... before start if it runs past midnight */
+	int active;	/* tasks downloading per NAS, -1 to leave it */
+	int dn;		/* KB/s, 0 for no limit, -1 for the NAS's own */
+	int up;
+};
+
+/* the limits of one NAS as its admin set them, while a window changes them */
+struct schedule_limits
+{
+	int saved[SYNO_LIMITS];
+	int changed;
+};
+
+struct schedule
+{
+	struct schedule_window w[SCHEDULE_MAX];
+	int n;
+};
+
+int schedule_find(const struct schedule *sc, time_t now);
+void schedule_get(const struct schedule *sc, int i, int active,
+					struct schedule_window *w);
+int schedule_wait(time_t now);
+int schedule_limits(struct schedule_limits *sl, const char *base,
+					struct session *s, int dn, int up);
+
+#endif
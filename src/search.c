@@ -0,0 +1,484 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "search.h"
+#include "tasks.h"
+
+/*
+ * Task titles are indexed by the trigrams of their case-folded form. Every
+ * trigram has a posting list of the entries containing it, ordered by their
+ * sequence number: new tasks always arrive with the highest one, so adding
+ * them is an append, and a task can be found again by bisection when it
+ * goes away.
+ */
+
+struct posting
+{
+	uint32_t tri;
+	struct tasklist_ent **ents;
+	int len;
+	int cap;
+};
+
+static struct posting *postings;
+static int postings_size, postings_used;
+
+/* the current query, its matches in view order and the stamp they carry */
+static char query[64];
+static struct tasklist_ent **results;
+static int results_len, results_cap, results_valid;
+static unsigned int stamp;
+
+static void
+fold(char *dst, const char *src, int len)
+{
+	int i;
+
+	for (i = 0; i < len - 1 && src[i]; i++)
+	{
+		dst[i] = (src[i] >= 'A' && src[i] <= 'Z') ? src[i] + 32 : src[i];
+	}
+
+	dst[i] = 0;
+}
+
+static uint32_t
+trigram(const char *s)
+{
+	return (unsigned char) s[0] << 16 | (unsigned char) s[1] << 8 |
+		(unsigned char) s[2];
+}
+
+/*
+	Index
+*/
+
+static struct posting *
+posting_find(uint32_t tri, int create)
+{
+	struct posting *old, *p;
+	int i, old_size;
+	uint32_t h;
+
+	if (create && postings_used >= postings_size / 2)
+	{
+		old = postings;
+		old_size = postings_size;
+
+		postings_size = postings_size ? postings_size * 2 : 4096;
+		postings = calloc(postings_size, sizeof(struct posting));
+
+		if (!postings)
+		{
+			postings = old;
+			postings_size = old_size;
+			return NULL;
+		}
+
+		for (i = 0; i < old_size; i++)
+		{
+			if (!old[i].ents)
+			{
+				continue;
+			}
+
+			h = old[i].tri * 2654435761u;
+
+			while (postings[h & (postings_size - 1)].ents)
+			{
+				h++;
+			}
+
+			postings[h & (postings_size - 1)] = old[i];
+		}
+
+		free(old);
+	}
+
+	if (!postings)
+	{
+		return NULL;
+	}
+
+	/* linear probing; empty posting lists stay allocated and in place */
+	for (h = tri * 2654435761u; ; h++)
+	{
+		p = &postings[h & (postings_size - 1)];
+
+		if (p->ents && p->tri == tri)
+		{
+			return p;
+		}
+
+		if (!p->ents)
+		{
+			break;
+		}
+	}
+
+	if (!create)
+	{
+		return NULL;
+	}
+
+	p->ents = malloc(4 * sizeof(struct tasklist_ent *));
+
+	if (!p->ents)
+	{
+		return NULL;
+	}
+
+	p->tri = tri;
+	p->len = 0;
+	p->cap = 4;
+	postings_used += 1;
+	return p;
+}
+
+/* index of the first entry in p with a sequence number >= seq */
+static int
+posting_bisect(struct posting *p, unsigned int seq)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = p->len;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+
+		if (p->ents[mid]->seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void
+posting_insert(struct posting *p, struct tasklist_ent *ent)
+{
+	struct tasklist_ent **tmp;
+	int i;
+
+	i = posting_bisect(p, ent->seq);
+
+	/* trigrams repeat within a title */
+	if (i < p->len && p->ents[i] == ent)
+	{
+		return;
+	}
+
+	if (p->len == p->cap)
+	{
+		tmp = realloc(p->ents, p->cap * 2 * sizeof(struct tasklist_ent *));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return;
+		}
+
+		p->ents = tmp;
+		p->cap *= 2;
+	}
+
+	memmove(&p->ents[i + 1], &p->ents[i],
+		(p->len - i) * sizeof(struct tasklist_ent *));
+	p->ents[i] = ent;
+	p->len += 1;
+}
+
+static void
+posting_delete(struct posting *p, struct tasklist_ent *ent)
+{
+	int i;
+
+	i = posting_bisect(p, ent->seq);
+
+	if (i < p->len && p->ents[i] == ent)
+	{
+		memmove(&p->ents[i], &p->ents[i + 1],
+			(p->len - i - 1) * sizeof(struct tasklist_ent *));
+		p->len -= 1;
+	}
+}
+
+void
+search_add(struct tasklist_ent *ent)
+{
+	struct posting *p;
+	int i;
+
+	fold(ent->fold, ent->t->fn, sizeof(ent->fold));
+
+	for (i = 0; ent->fold[i] && ent->fold[i + 1] && ent->fold[i + 2]; i++)
+	{
+		if ((p = posting_find(trigram(&ent->fold[i]), 1)))
+		{
+			posting_insert(p, ent);
+		}
+		else
+		{
+			fprintf(stderr, "Malloc failed\n");
+		}
+	}
+
+	/* keep the highlights of a running search current */
+	ent->hit = (query[0] && strstr(ent->fold, query)) ? stamp : 0;
+	results_valid = 0;
+}
+
+void
+search_remove(struct tasklist_ent *ent)
+{
+	struct posting *p;
+	int i;
+
+	for (i = 0; ent->fold[i] && ent->fold[i + 1] && ent->fold[i + 2]; i++)
+	{
+		if ((p = posting_find(trigram(&ent->fold[i]), 0)))
+		{
+			posting_delete(p, ent);
+		}
+	}
+
+	ent->hit = 0;
+	results_valid = 0;
+}
+
+void
+search_free()
+{
+	int i;
+
+	for (i = 0; i < postings_size; i++)
+	{
+		free(postings[i].ents);
+	}
+
+	free(postings);
+	free(results);
+
+	postings = NULL;
+	postings_size = 0;
+	postings_used = 0;
+
+	results = NULL;
+	results_len = 0;
+	results_cap = 0;
+	results_valid = 0;
+	query[0] = 0;
+}
+
+/*
+	Queries
+*/
+
+static int
+results_add(struct tasklist_ent *ent)
+{
+	struct tasklist_ent **tmp;
+
+	if (results_len == results_cap)
+	{
+		results_cap = results_cap ? results_cap * 2 : 256;
+		tmp = realloc(results, results_cap * sizeof(struct tasklist_ent *));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return 1;
+		}
+
+		results = tmp;
+	}
+
+	results[results_len++] = ent;
+	return 0;
+}
+
+static int
+cmp_pos(const void *pa, const void *pb)
+{
+	struct tasklist_ent *a = *(struct tasklist_ent **) pa;
+	struct tasklist_ent *b = *(struct tasklist_ent **) pb;
+
+	return a->pos - b->pos;
+}
+
+/* candidates from the shortest posting list of the query's trigrams */
+static void
+run_indexed(const char *q)
+{
+	struct posting *p, *best;
+	int i;
+
+	best = NULL;
+
+	for (i = 0; q[i + 2]; i++)
+	{
+		if (!(p = posting_find(trigram(&q[i]), 0)) || p->len == 0)
+		{
+			return;
+		}
+
+		if (!best || p->len < best->len)
+		{
+			best = p;
+		}
+	}
+
+	for (i = 0; i < best->len; i++)
+	{
+		if (best->ents[i]->pos >= 0 && strstr(best->ents[i]->fold, q))
+		{
+			best->ents[i]->hit = stamp;
+
+			if (results_add(best->ents[i]) != 0)
+			{
+				break;
+			}
+		}
+	}
+
+	qsort(results, results_len, sizeof(struct tasklist_ent *), cmp_pos);
+}
+
+/* too short for a trigram: look at every row in the view */
+static void
+run_scan(const char *q)
+{
+	int i;
+
+	for (i = 0; i < view.len; i++)
+	{
+		if (strstr(view.ents[i]->fold, q))
+		{
+			view.ents[i]->hit = stamp;
+
+			if (results_add(view.ents[i]) != 0)
+			{
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Finds the rows of the view whose title contains the query and returns
+ * them in view order. While the query only grows, the previous results are
+ * narrowed down instead of asking the index again.
+ */
+int
+search_run(const char *q, struct tasklist_ent ***res)
+{
+	char folded[sizeof(query)];
+	int i, n;
+
+	fold(folded, q, sizeof(folded));
+	stamp += 1;
+
+	if (results_valid && query[0] && !strncmp(folded, query, strlen(query)))
+	{
+		for (i = 0, n = 0; i < results_len; i++)
+		{
+			if (strstr(results[i]->fold, folded))
+			{
+				results[i]->hit = stamp;
+				results[n++] = results[i];
+			}
+		}
+
+		results_len = n;
+	}
+	else
+	{
+		results_len = 0;
+
+		if (strlen(folded) >= 3)
+			run_indexed(folded);
+		else if (folded[0])
+			run_scan(folded);
+	}
+
+	strcpy(query, folded);
+	results_valid = 1;
+
+	*res = results;
+	return results_len;
+}
+
+void
+search_clear()
+{
+	query[0] = 0;
+	stamp += 1;
+	results_len = 0;
+	results_valid = 0;
+}
+
+/* whether ent matches the search, and where in its title */
+int
+search_hit(struct tasklist_ent *ent, int *len)
+{
+	char *p;
+
+	if (!query[0] || ent->hit != stamp || !(p = strstr(ent->fold, query)))
+	{
+		return -1;
+	}
+
+	*len = strlen(query);
+	return p - ent->fold;
+}
+
+/* the next match in view order after from, wrapping around */
+struct tasklist_ent *
+search_next(struct tasklist_ent *from, int dir)
+{
+	int i, n, start;
+
+	if (!query[0] || view.len == 0)
+	{
+		return NULL;
+	}
+
+	start = (from && from->pos >= 0) ? from->pos : (dir > 0 ? -1 : 0);
+
+	for (n = 1; n <= view.len; n++)
+	{
+		i = ((start + dir * n) % view.len + view.len) % view.len;
+
+		if (view.ents[i]->hit == stamp)
+		{
+			return view.ents[i];
+		}
+	}
+
+	return NULL;
+}
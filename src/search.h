@@ -0,0 +1,35 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_SEARCH_H
+#define __SYNODL_SEARCH_H
+
+#include "tasks.h"
+
+void search_add(struct tasklist_ent *ent);
+void search_remove(struct tasklist_ent *ent);
+void search_free();
+
+int search_run(const char *query, struct tasklist_ent ***res);
+void search_clear();
+int search_hit(struct tasklist_ent *ent, int *len);
+struct tasklist_ent *search_next(struct tasklist_ent *from, int dir);
+
+#endif
@@ -0,0 +1,172 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include "cmd.h"
+#include "queue.h"
+#include "stall.h"
+#include "tasks.h"
+
+/*
+ * Notices tasks that claim to be downloading but have not received a byte
+ * for a while. Depending on the policy they are only flagged, or paused and
+ * resumed (which often gets a stuck tracker or HTTP connection going again),
+ * or paused and put at the back of the queue, so the queue manager gives
+ * their slot to the next task and tries them again last.
+ */
+
+static struct stall_policy policy;
+static struct stall_stats stats;
+
+void
+stall_init(const struct stall_policy *p)
+{
+	memcpy(&policy, p, sizeof(struct stall_policy));
+	memset(&stats, 0, sizeof(struct stall_stats));
+}
+
+void
+stall_stats(struct stall_stats *s)
+{
+	memcpy(s, &stats, sizeof(struct stall_stats));
+}
+
+static int
+restart(struct tasklist_ent *ent,
+		int (*submit)(struct tasklist_ent *, enum cmd_method))
+{
+	if (submit(ent, CMD_PAUSE) != 0)
+	{
+		return 0;
+	}
+
+	if (policy.action == STALL_BACK && queue_enabled())
+	{
+		queue_to_back(ent);
+		ent->queued = 1;
+	}
+	else
+	{
+		ent->cycling = 1;
+	}
+
+	/* not again before the hold time of the queue manager is up */
+	ent->switched = time(NULL);
+	ent->rescued = ent->t->downloaded;
+	ent->recovered = 0;
+	stats.restarted++;
+	return 1;
+}
+
+/*
+ * Looks at the tasks of a NAS after a refresh and submits the commands the
+ * policy asks for. Returns the number of commands submitted.
+ */
+int
+stall_run(int nas, int (*submit)(struct tasklist_ent *, enum cmd_method),
+			void (*notice)(struct tasklist_ent *, const char *))
+{
+	struct tasklist_ent *ent;
+	struct task *t;
+	time_t now;
+	int stalled, sent;
+
+	if (policy.window <= 0)
+	{
+		return 0;
+	}
+
+	now = time(NULL);
+	sent = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		t = ent->t;
+
+		if (ent->nas != nas)
+		{
+			continue;
+		}
+
+		/* what a restarted task gets done counts as reclaimed */
+		if (ent->rescued >= 0 && t->downloaded > ent->progress)
+		{
+			if (!ent->recovered)
+			{
+				ent->recovered = 1;
+				stats.recovered++;
+				notice(ent, "is downloading again");
+			}
+
+			stats.reclaimed += t->downloaded - ent->progress;
+		}
+
+		/* only time spent downloading counts */
+		if (t->downloaded != ent->progress || strcmp(t->status,
+				"downloading") || !ent->progress_at)
+		{
+			ent->progress = t->downloaded;
+			ent->progress_at = now;
+		}
+
+		stalled = now - ent->progress_at >= policy.window;
+
+		if (stalled != ent->stalled)
+		{
+			ent->stalled = stalled;
+			ent->dirty = 1;
+			stats.detected += stalled;
+		}
+
+		/* the second half of a pause/resume cycle, unless the pause failed */
+		if (ent->cycling && strcmp(t->status, "paused"))
+		{
+			ent->cycling = 0;
+		}
+		else if (ent->cycling)
+		{
+			if (submit(ent, CMD_RESUME) == 0)
+			{
+				sent++;
+			}
+			continue;
+		}
+
+		if (!stalled || policy.action == STALL_NONE ||
+							queue_held(ent))
+		{
+			continue;
+		}
+
+		if (restart(ent, submit))
+		{
+			notice(ent, policy.action == STALL_BACK &&
+				queue_enabled() ? "stalled, moved to the back" :
+				"stalled, restarting it");
+			ent->stalled = 0;
+			ent->progress_at = now;
+			sent++;
+		}
+	}
+
+	return sent;
+}
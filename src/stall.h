@@ -0,0 +1,54 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_STALL_H
+#define __SYNODL_STALL_H
+
+#include "cmd.h"
+#include "tasks.h"
+
+enum stall_action
+{
+	STALL_NONE,	/* only show them */
+	STALL_CYCLE,	/* pause and resume them */
+	STALL_BACK	/* let the queue manager move on to the next task */
+};
+
+struct stall_policy
+{
+	int window;	/* s without progress, 0 to disable */
+	enum stall_action action;
+};
+
+/* what has come of it so far */
+struct stall_stats
+{
+	int detected;
+	int restarted;
+	int recovered;	/* downloading again after being restarted */
+	int64_t reclaimed;	/* bytes they downloaded since */
+};
+
+void stall_init(const struct stall_policy *policy);
+int stall_run(int nas, int (*submit)(struct tasklist_ent *, enum cmd_method),
+				void (*notice)(struct tasklist_ent *, const char *));
+void stall_stats(struct stall_stats *stats);
+
+#endif
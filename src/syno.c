@@ -18,9 +18,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <curl/curl.h>
 
+#include <sys/stat.h>
+
 #include "config.h"
 
 #ifdef HAVE_JSON_C
@@ -32,33 +38,156 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 #include "syno.h"
-#include "ui.h"
 
-struct string
+/* files sent to the NAS at the same time */
+#define UPLOADS 4
+
+/* transient failures are retried, waiting 250 ms, 500 ms, 1 s, ... */
+#define RETRIES 3
+#define BACKOFF_MS 250
+#define BACKOFF_MAX_MS 4000
+
+static const char *op_names[] = {
+	"login", "list", "statistic", "task", "create", "info", "btsearch",
+	"config"
+};
+
+struct list_cache
+{
+	char etag[64];
+	char modified[40];
+	uint64_t hash;
+};
+
+/* a reply as it came in, NUL-terminated */
+struct syno_buf
 {
-	int size;
 	char *ptr;
+	int size;	/* including the NUL */
+	int cap;
 };
 
-static int
-init_string(struct string *s)
+struct session
 {
-	s->size = 1;
-	s->ptr = malloc(s->size);
+	char sid[24];
+	CURL *curl;
+	CURLM *multi;	/* for uploads */
+	struct syno_buf reply;	/* of the last request, reused */
+	struct list_cache list_cache;
+	struct syno_stats stats;
 
-	if (!s->ptr)
+	/* ms to get connected and to get the whole request done */
+	struct
 	{
-		fprintf(stderr, "Malloc failed\n");
-		return 1;
+		long connect;
+		long total;
+	} timeouts[SYNO_OPS];
+
+	int (*relogin)(struct session *s, void *arg);
+	void *relogin_arg;
+
+	int (*progress)(void *arg, int64_t bytes, double elapsed);
+	void *progress_arg;
+};
+
+/* the request curl_do() is working on, for the progress callback */
+struct transfer
+{
+	struct session *s;
+	double start;
+};
+
+/* error of the last request made by this thread, see syno_strerror() */
+static __thread int api_error;
+static __thread unsigned int seed;
+
+/* curl_global_init() is not thread-safe before curl 7.84 */
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct
+{
+	int code;
+	const char *text;
+} api_errors[] = {
+	{ 100, "Unknown error" },
+	{ 101, "Invalid parameter" },
+	{ 102, "API does not exist" },
+	{ 103, "Method does not exist" },
+	{ 104, "Version not supported" },
+	{ 105, "Permission denied" },
+	{ 106, "Session timed out" },
+	{ 107, "Session interrupted by another login" },
+	{ 119, "Session not found" },
+	{ 400, "Request failed" },
+	{ 401, "Too many tasks" },
+	{ 402, "Destination denied" },
+	{ 403, "Destination does not exist" },
+	{ 404, "Invalid task" },
+	{ 405, "Invalid task action" },
+	{ 406, "No default destination" },
+	{ 407, "Failed to set destination" },
+	{ 408, "File does not exist" },
+};
+
+/* empties a buffer, keeping what it has allocated */
+static int
+reset_buf(struct syno_buf *b)
+{
+	if (!b->ptr)
+	{
+		b->cap = 4096;
+
+		if (!(b->ptr = malloc(b->cap)))
+		{
+			fprintf(stderr, "Malloc failed\n");
+			b->cap = 0;
+			return 1;
+		}
 	}
 
+	b->size = 1;
+	b->ptr[0] = 0;
 	return 0;
 }
 
 static void
-free_string(struct string *s)
+free_buf(struct syno_buf *b)
+{
+	free(b->ptr);
+	b->ptr = NULL;
+	b->size = 0;
+	b->cap = 0;
+}
+
+/* FNV-1a, fast enough to not show up next to the JSON parser */
+static uint64_t
+hash(const void *buf, size_t len)
 {
-	free(s->ptr);
+	const unsigned char *p = buf;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--)
+	{
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/* the code of a failed request, 100 (unknown) if the server gave none */
+static int
+json_error_code(json_object *obj)
+{
+	json_object *error, *code;
+
+	if (!json_object_object_get_ex(obj, "error", &error) ||
+			!json_object_object_get_ex(error, "code", &code))
+	{
+		return 100;
+	}
+
+	return json_object_get_int(code);
 }
 
 static int
@@ -81,6 +210,12 @@ json_check_success(json_object *obj)
 	}
 
 	login_success = json_object_get_int(success);
+
+	if (!login_success)
+	{
+		api_error = json_error_code(obj);
+	}
+
 	return login_success == 0;
 }
 
@@ -107,10 +242,71 @@ json_load_login(json_object *obj, struct session *s)
 	return 0;
 }
 
+static void
+json_load_task(json_object *task, struct task *dt)
+{
+	json_object *tmp, *additional, *transfer;
+
+	memset(dt, 0, sizeof(struct task));
+	additional = NULL;
+
+	json_object_object_get_ex(task, "id", &tmp);
+	snprintf(dt->id, sizeof(dt->id), "%s",
+					json_object_get_string(tmp));
+
+	json_object_object_get_ex(task, "title", &tmp);
+	snprintf(dt->fn, sizeof(dt->fn), "%s",
+					json_object_get_string(tmp));
+
+	json_object_object_get_ex(task, "status", &tmp);
+	snprintf(dt->status, sizeof(dt->status), "%s",
+					json_object_get_string(tmp));
+
+	/* bt, http, ftp, nzb or emule */
+	if (json_object_object_get_ex(task, "type", &tmp))
+	{
+		snprintf(dt->type, sizeof(dt->type), "%s",
+					json_object_get_string(tmp));
+	}
+
+	json_object_object_get_ex(task, "size", &tmp);
+	dt->size = json_object_get_int64(tmp);
+
+	json_object_object_get_ex(task, "additional", &additional);
+	if (json_object_object_get_ex(additional, "transfer", &transfer))
+	{
+		json_object_object_get_ex(transfer,
+					"size_downloaded", &tmp);
+		dt->downloaded = json_object_get_int64(tmp);
+
+		json_object_object_get_ex(transfer,
+					"speed_download", &tmp);
+		dt->speed_dn = json_object_get_int(tmp);
+
+		json_object_object_get_ex(transfer,
+						"speed_upload", &tmp);
+		dt->speed_up = json_object_get_int(tmp);
+
+		if ((dt->size != 0) && (dt->downloaded != 0))
+		{
+			dt->percent_dn = ((float)dt->downloaded / dt->size)
+								* 100;
+		}
+
+		json_object_object_get_ex(transfer,
+						"size_uploaded", &tmp);
+		dt->uploaded = json_object_get_int64(tmp);
+	}
+
+	/* all padding is zeroed above, so hashing the bytes is safe */
+	dt->fp = hash(dt, sizeof(struct task));
+}
+
 static int
-json_load_tasks(json_object *obj, void (*cb)(struct task *))
+json_load_tasks(json_object *obj, void (*cb)(struct task *, void *),
+								void *arg)
 {
-	json_object *data, *tasks, *task, *tmp, *additional, *transfer;
+	json_object *data, *tasks;
 	struct task dt;
 	int i;
 
@@ -140,399 +336,1760 @@ json_load_tasks(json_object *obj, void (*cb)(struct task *))
 
 	for (i=0; i < json_object_array_length(tasks); i++)
 	{
-		memset(&dt, 0, sizeof(struct task));
-
-		task = json_object_array_get_idx(tasks, i);
+		json_load_task(json_object_array_get_idx(tasks, i), &dt);
+		cb(&dt, arg);
+	}
 
-		json_object_object_get_ex(task, "id", &tmp);
-		snprintf(dt.id, sizeof(dt.id), "%s",
-						json_object_get_string(tmp));
+	return 0;
+}
 
-		json_object_object_get_ex(task, "title", &tmp);
-		snprintf(dt.fn, sizeof(dt.fn), "%s",
-						json_object_get_string(tmp));
+/* copies a string member, leaving buf empty if there is none */
+static void
+json_copy_string(json_object *obj, const char *key, char *buf, int len)
+{
+	json_object *tmp;
 
-		json_object_object_get_ex(task, "status", &tmp);
-		snprintf(dt.status, sizeof(dt.status), "%s",
-						json_object_get_string(tmp));
+	if (json_object_object_get_ex(obj, key, &tmp))
+		snprintf(buf, len, "%s", json_object_get_string(tmp));
+	else
+		buf[0] = 0;
+}
 
-		json_object_object_get_ex(task, "size", &tmp);
-		dt.size = json_object_get_int64(tmp);
+static int64_t
+json_get_int64(json_object *obj, const char *key)
+{
+	json_object *tmp;
 
-		json_object_object_get_ex(task, "additional", &additional);
-		if (json_object_object_get_ex(additional, "transfer", &transfer))
-		{
-			json_object_object_get_ex(transfer,
-						"size_downloaded", &tmp);
-			dt.downloaded = json_object_get_int64(tmp);
+	if (!json_object_object_get_ex(obj, key, &tmp))
+	{
+		return 0;
+	}
 
-			json_object_object_get_ex(transfer,
-						"speed_download", &tmp);
-			dt.speed_dn = json_object_get_int(tmp);
+	return json_object_get_int64(tmp);
+}
 
-			json_object_object_get_ex(transfer,
-							"speed_upload", &tmp);
-			dt.speed_up = json_object_get_int(tmp);
+/* allocates one element per entry of an array member */
+static void *
+json_alloc_array(json_object *obj, const char *key, size_t size, int *n,
+							json_object **arr)
+{
+	void *res;
 
-			if ((dt.size != 0) && (dt.downloaded != 0))
-			{
-				dt.percent_dn = ((float)dt.downloaded / dt.size)
-									* 100;
-			}
-		}
+	*n = 0;
 
-		json_object_object_get_ex(transfer, "size_uploaded", &tmp);
-		dt.uploaded = json_object_get_int64(tmp);
+	if (!json_object_object_get_ex(obj, key, arr) ||
+			json_object_get_type(*arr) != json_type_array ||
+			json_object_array_length(*arr) == 0)
+	{
+		return NULL;
+	}
 
-		cb(&dt);
+	if (!(res = calloc(json_object_array_length(*arr), size)))
+	{
+		fprintf(stderr, "Calloc failed\n");
+		return NULL;
 	}
 
-	return 0;
+	*n = json_object_array_length(*arr);
+	return res;
 }
 
 static int
-json_load_reply(json_object *obj)
+json_load_info(json_object *obj, struct task_info *info)
 {
+	json_object *data, *tasks, *task, *additional, *detail, *arr, *tmp;
+	json_object *val;
+	int i;
+
 	if (json_check_success(obj) != 0)
 	{
 		return 1;
 	}
 
-	return 0;
-}
+	if (!json_object_object_get_ex(obj, "data", &data) ||
+			!json_object_object_get_ex(data, "tasks", &tasks) ||
+			json_object_get_type(tasks) != json_type_array ||
+			json_object_array_length(tasks) < 1)
+	{
+		fprintf(stderr, "No task found in %s\n",
+						json_object_get_string(obj));
+		return 1;
+	}
 
-static int
-session_load(struct string *st, struct session *session)
-{
-	json_tokener *tok;
-	json_object *obj;
+	task = json_object_array_get_idx(tasks, 0);
+	json_load_task(task, &info->t);
 
-	tok = json_tokener_new();
-	if (!tok)
+	if (!json_object_object_get_ex(task, "additional", &additional))
 	{
-		fprintf(stderr, "Failed to initialize JSON tokener\n");
-		return 1;
+		return 0;
 	}
 
-	obj = json_tokener_parse_ex(tok, st->ptr, st->size);
-	json_tokener_free(tok);
+	if (json_object_object_get_ex(additional, "detail", &detail))
+	{
+		json_copy_string(detail, "destination", info->destination,
+						sizeof(info->destination));
+		json_copy_string(detail, "uri", info->uri, sizeof(info->uri));
+		info->created = json_get_int64(detail, "create_time");
+		info->seeders = json_get_int64(detail, "connected_seeders");
+		info->leechers = json_get_int64(detail, "connected_leechers");
+		info->total_peers = json_get_int64(detail, "total_peers");
+	}
 
-	if (is_error(obj))
+	info->files = json_alloc_array(additional, "file",
+			sizeof(struct task_file), &info->nfiles, &arr);
+
+	for (i = 0; i < info->nfiles; i++)
 	{
-		fprintf(stderr, "Failed to decode JSON data\n");
-		json_object_put(obj);
-		return 1;
+		tmp = json_object_array_get_idx(arr, i);
+		json_copy_string(tmp, "filename", info->files[i].name,
+						sizeof(info->files[i].name));
+		json_copy_string(tmp, "priority", info->files[i].priority,
+					sizeof(info->files[i].priority));
+		info->files[i].size = json_get_int64(tmp, "size");
+		info->files[i].downloaded = json_get_int64(tmp,
+							"size_downloaded");
+	}
+
+	info->peers = json_alloc_array(additional, "peer",
+			sizeof(struct task_peer), &info->npeers, &arr);
+
+	for (i = 0; i < info->npeers; i++)
+	{
+		tmp = json_object_array_get_idx(arr, i);
+		json_copy_string(tmp, "address", info->peers[i].address,
+					sizeof(info->peers[i].address));
+		json_copy_string(tmp, "agent", info->peers[i].agent,
+					sizeof(info->peers[i].agent));
+
+		if (json_object_object_get_ex(tmp, "progress", &val))
+		{
+			info->peers[i].progress = json_object_get_double(val);
+		}
+
+		info->peers[i].speed_dn = json_get_int64(tmp,
+							"speed_download");
+		info->peers[i].speed_up = json_get_int64(tmp, "speed_upload");
+	}
+
+	info->trackers = json_alloc_array(additional, "tracker",
+			sizeof(struct task_tracker), &info->ntrackers, &arr);
+
+	for (i = 0; i < info->ntrackers; i++)
+	{
+		tmp = json_object_array_get_idx(arr, i);
+		json_copy_string(tmp, "url", info->trackers[i].url,
+					sizeof(info->trackers[i].url));
+		json_copy_string(tmp, "status", info->trackers[i].status,
+					sizeof(info->trackers[i].status));
+		info->trackers[i].seeds = json_get_int64(tmp, "seeds");
+		info->trackers[i].peers = json_get_int64(tmp, "peers");
 	}
 
-	json_load_login(obj, session);
-	json_object_put(obj);
 	return 0;
 }
 
 static int
-tasks_receive(struct string *st, void (*cb)(struct task *))
+json_load_bt_start(json_object *obj, char *taskid, int len)
 {
-	int res;
-	json_tokener *tok;
-	json_object *obj;
+	json_object *data;
 
-	tok = json_tokener_new();
-	if (!tok)
+	if (json_check_success(obj) != 0)
 	{
-		fprintf(stderr, "Failed to initialize JSON tokener\n");
 		return 1;
 	}
 
-	obj = json_tokener_parse_ex(tok, st->ptr, st->size);
-	json_tokener_free(tok);
-
-	if (is_error(obj))
+	if (!json_object_object_get_ex(obj, "data", &data))
 	{
-		fprintf(stderr, "Failed to decode JSON data\n");
-		json_object_put(obj);
+		fprintf(stderr, "Value 'data' missing from %s\n",
+						json_object_get_string(obj));
 		return 1;
 	}
 
-	res = json_load_tasks(obj, cb);
-	json_object_put(obj);
-	return res;
+	json_copy_string(data, "taskid", taskid, len);
+	return taskid[0] == 0;
 }
 
 static int
-parse_reply(struct string *st)
+json_load_bt_list(json_object *obj, struct bt_result **res, int *n,
+							int *finished)
 {
-	int res;
-	json_tokener *tok;
-	json_object *obj;
+	json_object *data, *items, *item, *tmp;
+	struct bt_result *r;
+	int i;
 
-	tok = json_tokener_new();
-	if (!tok)
+	if (json_check_success(obj) != 0)
 	{
-		fprintf(stderr, "Failed to initialize JSON tokener\n");
 		return 1;
 	}
 
-	obj = json_tokener_parse_ex(tok, st->ptr, st->size);
-	json_tokener_free(tok);
-
-	if (is_error(obj))
+	if (!json_object_object_get_ex(obj, "data", &data))
 	{
-		fprintf(stderr, "Failed to decode JSON data\n");
-		json_object_put(obj);
+		fprintf(stderr, "Value 'data' missing from %s\n",
+						json_object_get_string(obj));
 		return 1;
 	}
 
-	res = json_load_reply(obj);
-	json_object_put(obj);
-	return res;
-}
-
-/*
- * cURL helpers
- */
-
-static size_t
-curl_recv(void *ptr, size_t size, size_t nmemb, struct string *s)
-{
-	int pos;
+	if (json_object_object_get_ex(data, "finished", &tmp))
+	{
+		*finished = json_object_get_boolean(tmp);
+	}
 
-	pos = s->size - 1;
-	s->size += (size * nmemb);
-	s->ptr = realloc(s->ptr, s->size);
+	*res = json_alloc_array(data, "items", sizeof(struct bt_result), n,
+								&items);
 
-	if (!s->ptr)
+	for (i = 0; i < *n; i++)
 	{
-		fprintf(stderr, "Realloc failed");
-		return -1;
+		item = json_object_array_get_idx(items, i);
+		r = &(*res)[i];
+
+		json_copy_string(item, "title", r->title, sizeof(r->title));
+		json_copy_string(item, "download_uri", r->uri, sizeof(r->uri));
+		json_copy_string(item, "provider", r->provider,
+							sizeof(r->provider));
+		json_copy_string(item, "date", r->date, sizeof(r->date));
+
+		/* sizes come as strings, which json-c converts for us */
+		r->size = json_get_int64(item, "size");
+		r->seeds = json_get_int64(item, "seeds");
+		r->leechs = json_get_int64(item, "leechs");
 	}
 
-	memcpy(s->ptr + pos, ptr, size * nmemb);
-	s->ptr[s->size - 1] = 0;
-	return size * nmemb;
+	return 0;
 }
 
 static int
-curl_do(const char *url, void *cb_arg, struct string *st)
+json_load_statistic(json_object *obj, int *up, int *dn)
 {
-	CURL *curl;
-	CURLcode res;
+	json_object *data, *tmp;
 
-	curl_global_init(CURL_GLOBAL_DEFAULT);
-	curl = curl_easy_init();
-
-	if (!curl)
+	if (json_check_success(obj) != 0)
 	{
-		fprintf(stderr, "Failed to initialize CURL\n");
-		curl_global_cleanup();
 		return 1;
 	}
 
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_recv);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, st);
-
-	res = curl_easy_perform(curl);
-
-	if (res != CURLE_OK)
+	if (!json_object_object_get_ex(obj, "data", &data))
 	{
-		fprintf(stderr, "curl_easy_perform() failed: %s\n",
-						curl_easy_strerror(res));
-		curl_easy_cleanup(curl);
-		curl_global_cleanup();
+		fprintf(stderr, "Value 'data' missing from %s\n",
+						json_object_get_string(obj));
 		return 1;
 	}
 
-	curl_easy_cleanup(curl);
-	curl_global_cleanup();
+	*up = 0;
+	*dn = 0;
+
+	if (json_object_object_get_ex(data, "speed_upload", &tmp))
+		*up += json_object_get_int(tmp);
+	if (json_object_object_get_ex(data, "speed_download", &tmp))
+		*dn += json_object_get_int(tmp);
+	if (json_object_object_get_ex(data, "emule_speed_upload", &tmp))
+		*up += json_object_get_int(tmp);
+	if (json_object_object_get_ex(data, "emule_speed_download", &tmp))
+		*dn += json_object_get_int(tmp);
 
 	return 0;
 }
 
-/*
- * "public" functions
- */
+static const char *limit_keys[] = {
+	"bt_max_download", "bt_max_upload", "emule_max_download",
+	"emule_max_upload", "nzb_max_download", "http_max_download",
+	"ftp_max_download"
+};
 
-int
-syno_login(const char *base, struct session *s, const char *u, const char *pw)
+static int
+json_load_limits(json_object *obj, int *limits)
 {
-	char url[1024];
-	struct string st;
-
-	printf("Logging in...\n");
-
-	init_string(&st);
+	json_object *data, *tmp;
+	int i;
 
-	snprintf(url, sizeof(url), "%s/webapi/auth.cgi?api=SYNO.API.Auth"
-		"&version=2&method=login&account=%s&passwd=%s"
-		"&session=DownloadStation&format=sid", base, u, pw);
+	if (json_check_success(obj) != 0)
+	{
+		return 1;
+	}
 
-	if (curl_do(url, s, &st) != 0)
+	if (!json_object_object_get_ex(obj, "data", &data))
 	{
-		fprintf(stderr, "Login failed\n");
-		free_string(&st);
+		fprintf(stderr, "Value 'data' missing from %s\n",
+						json_object_get_string(obj));
 		return 1;
 	}
 
-	session_load(&st, s);
-	free_string(&st);
+	/* what the server does not mention is left alone */
+	for (i = 0; i < SYNO_LIMITS; i++)
+	{
+		limits[i] = -1;
+
+		if (json_object_object_get_ex(data, limit_keys[i], &tmp))
+			limits[i] = json_object_get_int(tmp);
+	}
 
-	if (!strcmp(s->sid, ""))
+	return 0;
+}
+
+static int
+json_load_reply(json_object *obj)
+{
+	if (json_check_success(obj) != 0)
 	{
-		fprintf(stderr, "Login failed\n");
 		return 1;
 	}
 
 	return 0;
 }
 
-int
-syno_logout(const char *base, struct session *s)
+static json_object *
+json_parse(const char *buf, int len)
 {
-	char url[1024];
-	int res;
-	struct string st;
+	json_tokener *tok;
+	json_object *obj;
 
-	init_string(&st);
+	tok = json_tokener_new();
+	if (!tok)
+	{
+		fprintf(stderr, "Failed to initialize JSON tokener\n");
+		return NULL;
+	}
 
-	snprintf(url, sizeof(url), "%s/webapi/auth.cgi?api=SYNO.API.Auth"
-		"&version=1&method=logout&session=DownloadStation"
-		"&_sid=%s", base, s->sid);
+	obj = json_tokener_parse_ex(tok, buf, len);
+	json_tokener_free(tok);
 
-	if (curl_do(url, s, &st) != 0)
+	if (is_error(obj))
 	{
-		free_string(&st);
-		return 1;
+		fprintf(stderr, "Failed to decode JSON data\n");
+		json_object_put(obj);
+		return NULL;
 	}
 
-	res = parse_reply(&st);
-	free_string(&st);
-	return res;
+	return obj;
 }
 
 int
-syno_list(const char *base, struct session *s, void (*cb)(struct task *))
+syno_parse_login(const char *buf, int len, struct session *session)
 {
-	char url[1024];
-	int res;
-	struct string st;
+	json_object *obj;
 
-	init_string(&st);
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
 
-	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
+	json_load_login(obj, session);
+	json_object_put(obj);
+	return 0;
+}
+
+int
+syno_parse_tasks(const char *buf, int len,
+			void (*cb)(struct task *t, void *arg), void *arg)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_tasks(obj, cb, arg);
+	json_object_put(obj);
+	return res;
+}
+
+int
+syno_parse_reply(const char *buf, int len)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_reply(obj);
+	json_object_put(obj);
+	return res;
+}
+
+static int
+parse_info(const char *buf, int len, struct task_info *info)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_info(obj, info);
+	json_object_put(obj);
+	return res;
+}
+
+static int
+parse_bt_start(const char *buf, int len, char *taskid, int size)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_bt_start(obj, taskid, size);
+	json_object_put(obj);
+	return res;
+}
+
+static int
+parse_bt_list(const char *buf, int len, struct bt_result **r, int *n,
+							int *finished)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_bt_list(obj, r, n, finished);
+	json_object_put(obj);
+	return res;
+}
+
+static int
+parse_statistic(const char *buf, int len, int *up, int *dn)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_statistic(obj, up, dn);
+	json_object_put(obj);
+	return res;
+}
+
+static int
+parse_limits(const char *buf, int len, int *limits)
+{
+	int res;
+	json_object *obj;
+
+	if (!(obj = json_parse(buf, len)))
+	{
+		return 1;
+	}
+
+	res = json_load_limits(obj, limits);
+	json_object_put(obj);
+	return res;
+}
+
+/*
+ * cURL helpers
+ */
+
+static size_t
+curl_recv(char *ptr, size_t size, size_t nmemb, void *data)
+{
+	struct syno_buf *b = data;
+	size_t len = size * nmemb;
+	char *tmp;
+	int cap;
+
+	/* doubling, a list reply comes in many small pieces */
+	for (cap = b->cap; b->size + len > cap; cap *= 2);
+
+	if (cap != b->cap)
+	{
+		if (!(tmp = realloc(b->ptr, cap)))
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return 0;
+		}
+
+		b->ptr = tmp;
+		b->cap = cap;
+	}
+
+	memcpy(b->ptr + b->size - 1, ptr, len);
+	b->size += len;
+	b->ptr[b->size - 1] = 0;
+	return len;
+}
+
+/* picks up the cache validators of a list reply */
+static size_t
+curl_header(char *ptr, size_t size, size_t nmemb, struct list_cache *v)
+{
+	size_t len = size * nmemb;
+	char *dst;
+	int dst_len, skip;
+
+	if (!strncasecmp(ptr, "ETag:", 5))
+	{
+		dst = v->etag;
+		dst_len = sizeof(v->etag);
+		skip = 5;
+	}
+	else if (!strncasecmp(ptr, "Last-Modified:", 14))
+	{
+		dst = v->modified;
+		dst_len = sizeof(v->modified);
+		skip = 14;
+	}
+	else
+	{
+		return len;
+	}
+
+	while (skip < len && ptr[skip] == ' ')
+	{
+		skip++;
+	}
+
+	snprintf(dst, dst_len, "%.*s", (int) strcspn(ptr + skip, "\r\n"),
+								ptr + skip);
+	return len;
+}
+
+static CURL *
+curl_handle(struct session *s)
+{
+	if (!s->curl)
+	{
+		pthread_mutex_lock(&global_lock);
+		curl_global_init(CURL_GLOBAL_DEFAULT);
+		pthread_mutex_unlock(&global_lock);
+
+		s->curl = curl_easy_init();
+
+		if (!s->curl)
+		{
+			fprintf(stderr, "Failed to initialize CURL\n");
+			pthread_mutex_lock(&global_lock);
+			curl_global_cleanup();
+			pthread_mutex_unlock(&global_lock);
+			return NULL;
+		}
+
+		syno_setup_handle(s->curl);
+	}
+
+	/* the handle is kept for the whole session to re-use connections */
+	return s->curl;
+}
+
+/* failures that might be gone by the time we ask again */
+static int
+transient(CURLcode res, long code)
+{
+	switch (res)
+	{
+	case CURLE_OK:
+		return code >= 500;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_PARTIAL_FILE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* for errors the server may have seen, resending must be harmless */
+static int
+unsent(CURLcode res)
+{
+	return res == CURLE_COULDNT_RESOLVE_HOST ||
+					res == CURLE_COULDNT_CONNECT;
+}
+
+/* the library has its own, see poller.c for the rest */
+static double
+now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Sleeps between half and all of the backoff, so clients spread out.
+ * Returns 1 without sleeping if that would take us past the deadline.
+ */
+static int
+backoff(int attempt, double deadline)
+{
+	struct timespec ts;
+	long ms;
+
+	if (!seed)
+	{
+		seed = time(NULL) ^ (uintptr_t) &seed;
+	}
+
+	ms = BACKOFF_MS << attempt;
+	ms = ms > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : ms;
+	ms = ms / 2 + rand_r(&seed) % (ms / 2 + 1);
+
+	if (now_ms() + ms >= deadline)
+	{
+		return 1;
+	}
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+	return 0;
+}
+
+static int
+curl_progress(void *p, curl_off_t dltotal, curl_off_t dlnow,
+					curl_off_t ultotal, curl_off_t ulnow)
+{
+	struct transfer *t = p;
+
+	return t->s->progress(t->s->progress_arg, dlnow,
+					(now_ms() - t->start) / 1000);
+}
+
+/*
+ * Sends a request, retrying transient failures with backoff until the
+ * deadline for its kind of request has passed. Creating tasks is not
+ * repeated once the request might have reached the server.
+ */
+static int
+curl_do(const char *url, struct session *s, enum syno_op op)
+{
+	CURL *curl;
+	CURLcode res;
+	curl_off_t wire;
+	struct transfer t;
+	double deadline;
+	long code, left;
+	int attempt;
+
+	api_error = 0;
+
+	if (!(curl = curl_handle(s)) || reset_buf(&s->reply) != 0)
+	{
+		return 1;
+	}
+
+	t.s = s;
+	t.start = now_ms();
+	deadline = t.start + s->timeouts[op].total;
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_recv);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s->reply);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+						s->timeouts[op].connect);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, s->progress ? 0L : 1L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_progress);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &t);
+
+	for (attempt = 0; ; attempt++)
+	{
+		/* 0 would mean no limit at all */
+		left = deadline - now_ms();
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, left > 1 ? left : 1L);
+		res = curl_easy_perform(curl);
+
+		code = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+		if (attempt == RETRIES || !transient(res, code) ||
+			(op == SYNO_OP_CREATE && !unsent(res)) ||
+					backoff(attempt, deadline))
+		{
+			break;
+		}
+
+		/* the owner may have given up while we waited */
+		if (s->progress && s->progress(s->progress_arg, 0,
+						(now_ms() - t.start) / 1000))
+		{
+			res = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+
+		/* whatever came back so far is no good */
+		reset_buf(&s->reply);
+	}
+
+	if (res != CURLE_OK)
+	{
+		fprintf(stderr, "curl_easy_perform() failed: %s\n",
+						curl_easy_strerror(res));
+		api_error = -res;
+		return 1;
+	}
+
+	if (code >= 500)
+	{
+		fprintf(stderr, "Server error %ld\n", code);
+		api_error = -CURLE_HTTP_RETURNED_ERROR;
+		return 1;
+	}
+
+	wire = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &s->stats.elapsed);
+	s->stats.wire_bytes = wire;
+	s->stats.body_bytes = s->reply.size - 1;
+
+	return 0;
+}
+
+/* the server has forgotten who we are */
+static int
+session_lost(int error)
+{
+	return error == 106 || error == 107 || error == 119;
+}
+
+/*
+ * Records how a request went. Returns 1 if it failed because the session
+ * has expired and the owner of the session has just logged in again, in
+ * which case the request is to be sent once more.
+ */
+static int
+replay(struct session *s, int res, int tries)
+{
+	s->stats.error = res ? api_error : 0;
+
+	if (!res || tries > 0 || !session_lost(s->stats.error) || !s->relogin)
+	{
+		return 0;
+	}
+
+	return s->relogin(s, s->relogin_arg) == 0;
+}
+
+/* res = call, a request on s, repeated once if replay() says so */
+#define REPLAYED(res, s, call)			\
+	do					\
+	{					\
+		int tries_ = 0;			\
+						\
+		do				\
+		{				\
+			res = call;		\
+		}				\
+		while (replay(s, res, tries_++));	\
+	}					\
+	while (0)
+
+/*
+ * "public" functions
+ */
+
+void
+syno_setup_handle(void *curl)
+{
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+
+	/* "" offers every encoding this libcurl can decode (gzip, br, ...) */
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+	/* HTTP/2 if the server agrees during the TLS handshake */
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+						(long) CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+	/* timeouts must not be signals, there are threads */
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 30L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 15L);
+}
+
+/* a session with no login yet and the default deadlines, NULL if out of memory */
+struct session *
+syno_new()
+{
+	struct session *s;
+	int i;
+
+	if (!(s = calloc(1, sizeof(struct session))))
+	{
+		fprintf(stderr, "Calloc failed\n");
+		return NULL;
+	}
+
+	for (i = 0; i < SYNO_OPS; i++)
+	{
+		s->timeouts[i].connect = 10000;
+		s->timeouts[i].total = 30000;
+	}
+
+	return s;
+}
+
+/* drops the connections and buffers of a session, they come back on use */
+static void
+session_close(struct session *s)
+{
+	if (s->multi)
+	{
+		curl_multi_cleanup(s->multi);
+		s->multi = NULL;
+	}
+
+	if (s->curl)
+	{
+		curl_easy_cleanup(s->curl);
+		s->curl = NULL;
+
+		pthread_mutex_lock(&global_lock);
+		curl_global_cleanup();
+		pthread_mutex_unlock(&global_lock);
+	}
+
+	free_buf(&s->reply);
+}
+
+/* releases a session, without logging out */
+void
+syno_free(struct session *s)
+{
+	if (!s)
+	{
+		return;
+	}
+
+	session_close(s);
+	free(s);
+}
+
+const char *
+syno_sid(const struct session *s)
+{
+	return s->sid;
+}
+
+void
+syno_set_sid(struct session *s, const char *sid)
+{
+	snprintf(s->sid, sizeof(s->sid), "%s", sid);
+}
+
+/* of the last request: API code, -CURLcode or 0 */
+int
+syno_error(const struct session *s)
+{
+	return s->stats.error;
+}
+
+void
+syno_stats(const struct session *s, struct syno_stats *stats)
+{
+	memcpy(stats, &s->stats, sizeof(struct syno_stats));
+}
+
+void
+syno_forget(struct session *s)
+{
+	memset(&s->list_cache, 0, sizeof(struct list_cache));
+}
+
+void
+syno_set_relogin(struct session *s,
+		int (*relogin)(struct session *s, void *arg), void *arg)
+{
+	s->relogin = relogin;
+	s->relogin_arg = arg;
+}
+
+void
+syno_set_progress(struct session *s,
+		int (*progress)(void *arg, int64_t bytes, double elapsed),
+		void *arg)
+{
+	s->progress = progress;
+	s->progress_arg = arg;
+}
+
+/* ms to get connected and to get a request of that kind done, retries too */
+void
+syno_set_timeout(struct session *s, enum syno_op op, int connect_ms,
+							int total_ms)
+{
+	s->timeouts[op].connect = connect_ms;
+	s->timeouts[op].total = total_ms;
+}
+
+const char *
+syno_op_name(enum syno_op op)
+{
+	return op_names[op];
+}
+
+void
+syno_login_url(char *url, int len, const char *base, const char *u,
+							const char *pw)
+{
+	snprintf(url, len, "%s/webapi/auth.cgi?api=SYNO.API.Auth"
+		"&version=2&method=login&account=%s&passwd=%s"
+		"&session=DownloadStation&format=sid", base, u, pw);
+}
+
+void
+syno_logout_url(char *url, int len, const char *base, struct session *s)
+{
+	snprintf(url, len, "%s/webapi/auth.cgi?api=SYNO.API.Auth"
+		"&version=1&method=logout&session=DownloadStation"
+		"&_sid=%s", base, s->sid);
+}
+
+void
+syno_list_url(char *url, int len, const char *base, struct session *s)
+{
+	snprintf(url, len, "%s/webapi/DownloadStation/task.cgi?"
 				"api=SYNO.DownloadStation.Task&version=2"
 				"&method=list&additional=transfer&_sid=%s",
 				base, s->sid);
+}
+
+/* returns the length of the full URL, even if it did not fit */
+int
+syno_task_url(char *url, int len, const char *base, struct session *s,
+					const char *method, const char *ids)
+{
+	return snprintf(url, len, "%s/webapi/DownloadStation/task.cgi?"
+				"api=SYNO.DownloadStation.Task&version=1"
+				"&method=%s&id=%s&_sid=%s%s", base, method, ids,
+				s->sid, strcmp(method, "delete") ? "" :
+				"&force_complete=false");
+}
+
+/* as above, uris can be several separated by commas; -1 if out of memory */
+int
+syno_create_url(char *url, int len, const char *base, struct session *s,
+							const char *uris)
+{
+	char *esc;
+	int res;
+
+	if (!(esc = curl_escape(uris, strlen(uris))))
+	{
+		return -1;
+	}
+
+	res = snprintf(url, len, "%s/webapi/DownloadStation/task.cgi?"
+			"api=SYNO.DownloadStation.Task&version=2&method=create"
+			"&uri=%s&_sid=%s", base, esc, s->sid);
+	curl_free(esc);
+
+	return res;
+}
+
+int
+syno_login(const char *base, struct session *s, const char *u, const char *pw)
+{
+	char url[1024];
+
+	syno_login_url(url, sizeof(url), base, u, pw);
+
+	/* an expired sid must not pass for a new one */
+	memset(s->sid, 0, sizeof(s->sid));
+
+	if (curl_do(url, s, SYNO_OP_LOGIN) != 0)
+	{
+		s->stats.error = api_error;
+		fprintf(stderr, "Login failed\n");
+		return 1;
+	}
+
+	syno_parse_login(s->reply.ptr, s->reply.size, s);
+	s->stats.error = api_error;
+
+	if (!strcmp(s->sid, ""))
+	{
+		fprintf(stderr, "Login failed\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+syno_logout(const char *base, struct session *s)
+{
+	char url[1024];
+	int res;
+
+	syno_logout_url(url, sizeof(url), base, s);
+
+	res = curl_do(url, s, SYNO_OP_LOGIN) ||
+				syno_parse_reply(s->reply.ptr, s->reply.size);
+	s->stats.error = res ? api_error : 0;
+	session_close(s);
+	return res;
+}
+
+static int
+get_list(const char *base, struct session *s,
+			void (*cb)(struct task *, void *), void *arg)
+{
+	char url[1024], buf[128];
+	int res;
+	long code;
+	uint64_t h;
+	struct list_cache v;
+	struct curl_slist *hdrs;
+	CURL *curl;
+
+	if (!(curl = curl_handle(s)))
+	{
+		return 1;
+	}
+
+	syno_list_url(url, sizeof(url), base, s);
+
+	hdrs = NULL;
+	memset(&v, 0, sizeof(struct list_cache));
+
+	if (strcmp(s->list_cache.etag, ""))
+	{
+		snprintf(buf, sizeof(buf), "If-None-Match: %s",
+							s->list_cache.etag);
+		hdrs = curl_slist_append(hdrs, buf);
+	}
+	if (strcmp(s->list_cache.modified, ""))
+	{
+		snprintf(buf, sizeof(buf), "If-Modified-Since: %s",
+						s->list_cache.modified);
+		hdrs = curl_slist_append(hdrs, buf);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &v);
+
+	res = curl_do(url, s, SYNO_OP_LIST);
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+	curl_slist_free_all(hdrs);
+
+	if (res != 0)
+	{
+		return 1;
+	}
+
+	code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+	if (code == 304)
+	{
+		return SYNO_UNCHANGED;
+	}
+
+	memcpy(s->list_cache.etag, v.etag, sizeof(v.etag));
+	memcpy(s->list_cache.modified, v.modified, sizeof(v.modified));
+
+	/* servers without validators still tend to repeat themselves */
+	h = hash(s->reply.ptr, s->reply.size);
+
+	if (s->list_cache.hash == h)
+	{
+		return SYNO_UNCHANGED;
+	}
+
+	res = syno_parse_tasks(s->reply.ptr, s->reply.size, cb, arg);
+
+	/* only trust the hash once the reply has been accepted */
+	s->list_cache.hash = res ? 0 : h;
+	return res;
+}
+
+static int
+get_statistic(const char *base, struct session *s, int *up, int *dn)
+{
+	char url[1024];
+
+	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/statistic.cgi?"
+			"api=SYNO.DownloadStation.Statistic&version=1"
+			"&method=getinfo&_sid=%s", base, s->sid);
+
+	return curl_do(url, s, SYNO_OP_STATISTIC) ||
+		parse_statistic(s->reply.ptr, s->reply.size, up, dn);
+}
+
+static int
+get_limits(const char *base, struct session *s, int *limits)
+{
+	char url[SYNO_URL_MAX];
+
+	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/info.cgi?"
+			"api=SYNO.DownloadStation.Info&version=1"
+			"&method=getserverconfig&_sid=%s", base, s->sid);
+
+	return curl_do(url, s, SYNO_OP_CONFIG) ||
+			parse_limits(s->reply.ptr, s->reply.size, limits);
+}
+
+static int
+set_limits(const char *base, struct session *s, const int *limits)
+{
+	char url[SYNO_URL_MAX], params[256];
+	int i, len;
+
+	len = 0;
+	params[0] = 0;
+
+	for (i = 0; i < SYNO_LIMITS && len < (int) sizeof(params); i++)
+	{
+		if (limits[i] >= 0)
+		{
+			len += snprintf(params + len, sizeof(params) - len,
+					"&%s=%d", limit_keys[i], limits[i]);
+		}
+	}
+
+	if (len >= (int) sizeof(params) || snprintf(url, sizeof(url),
+			"%s/webapi/DownloadStation/info.cgi?"
+			"api=SYNO.DownloadStation.Info&version=1"
+			"&method=setserverconfig%s&_sid=%s", base, params,
+					s->sid) >= (int) sizeof(url))
+	{
+		fprintf(stderr, "URL too long\n");
+		api_error = 0;
+		return 1;
+	}
+
+	if (curl_do(url, s, SYNO_OP_CONFIG) != 0)
+	{
+		return 1;
+	}
+
+	return syno_parse_reply(s->reply.ptr, s->reply.size);
+}
+
+static int
+create_task(const char *base, struct session *s, const char *dl_url)
+{
+	char url[SYNO_URL_MAX];
+	int len;
+
+	len = syno_create_url(url, sizeof(url), base, s, dl_url);
+
+	if (len < 0 || len >= (int) sizeof(url))
+	{
+		fprintf(stderr, "URL too long\n");
+		api_error = 0;
+		return 1;
+	}
+
+	if (curl_do(url, s, SYNO_OP_CREATE) != 0)
+	{
+		return 1;
+	}
 
-	if (curl_do(url, s, &st) != 0)
+	return syno_parse_reply(s->reply.ptr, s->reply.size);
+}
+
+static int
+task_method(const char *base, struct session *s, const char *method,
+							const char *ids)
+{
+	char url[SYNO_URL_MAX];
+
+	if (syno_task_url(url, sizeof(url), base, s, method, ids) >=
+								sizeof(url))
+	{
+		fprintf(stderr, "Too many ids for one request\n");
+		api_error = 0;
+		return 1;
+	}
+
+	if (curl_do(url, s, SYNO_OP_TASK) != 0)
 	{
-		free_string(&st);
 		return 1;
 	}
 
-	res = tasks_receive(&st, cb);
-	free_string(&st);
+	return syno_parse_reply(s->reply.ptr, s->reply.size);
+}
+
+int
+syno_pause(const char *base, struct session *s, const char *ids)
+{
+	int res;
+
+	REPLAYED(res, s, task_method(base, s, "pause", ids));
 	return res;
 }
 
 int
-syno_download(const char *base, struct session *s, const char *dl_url)
+syno_resume(const char *base, struct session *s, const char *ids)
 {
-	char url[1024], *esc;
 	int res;
-	struct string st;
 
-	init_string(&st);
+	REPLAYED(res, s, task_method(base, s, "resume", ids));
+	return res;
+}
 
-	esc = curl_escape(dl_url, strlen(dl_url));
-	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
-			"api=SYNO.DownloadStation.Task&version=2&method=create"
-			"&uri=%s&_sid=%s", base, esc, s->sid);
-	curl_free(esc);
+int
+syno_delete(const char *base, struct session *s, const char *ids)
+{
+	int res;
+
+	REPLAYED(res, s, task_method(base, s, "delete", ids));
+	return res;
+}
+
+static int
+get_info(const char *base, struct session *s, const char *id,
+						struct task_info *info)
+{
+	char url[SYNO_URL_MAX];
+	int res;
 
-	if (curl_do(url, s, &st) != 0)
+	memset(info, 0, sizeof(struct task_info));
+
+	if (snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
+			"api=SYNO.DownloadStation.Task&version=1&method=getinfo"
+			"&id=%s&additional=detail,transfer,file,peer,tracker"
+			"&_sid=%s", base, id, s->sid) >= sizeof(url))
 	{
-		free_string(&st);
+		fprintf(stderr, "URL too long\n");
+		api_error = 0;
 		return 1;
 	}
 
-	res = parse_reply(&st);
-	free_string(&st);
+	res = curl_do(url, s, SYNO_OP_INFO) ||
+				parse_info(s->reply.ptr, s->reply.size, info);
+
+	if (res != 0)
+	{
+		syno_info_free(info);
+	}
+
 	return res;
 }
 
-int
-syno_pause(const char *base, struct session *s, const char *ids)
+void
+syno_info_free(struct task_info *info)
 {
-	char url[1024];
-	int res;
-	struct string st;
+	free(info->files);
+	free(info->peers);
+	free(info->trackers);
+
+	info->files = NULL;
+	info->peers = NULL;
+	info->trackers = NULL;
+	info->nfiles = 0;
+	info->npeers = 0;
+	info->ntrackers = 0;
+}
 
-	init_string(&st);
+static int
+btsearch_start(const char *base, struct session *s, const char *keyword,
+						char *taskid, int len)
+{
+	char url[SYNO_URL_MAX], *esc;
+	int res;
 
-	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
-				"api=SYNO.DownloadStation.Task&version=1"
-				"&method=pause&id=%s&_sid=%s", base, ids,
-				s->sid);
+	esc = curl_escape(keyword, strlen(keyword));
+	res = snprintf(url, sizeof(url), "%s/webapi/DownloadStation/"
+			"btsearch.cgi?api=SYNO.DownloadStation.BTSearch"
+			"&version=1&method=start&keyword=%s&module=enabled"
+			"&_sid=%s", base, esc, s->sid);
+	curl_free(esc);
 
-	if (curl_do(url, s, &st) != 0)
+	if (res >= sizeof(url))
 	{
-		free_string(&st);
+		fprintf(stderr, "URL too long\n");
+		api_error = 0;
 		return 1;
 	}
 
-	res = parse_reply(&st);
-	free_string(&st);
+	res = curl_do(url, s, SYNO_OP_BTSEARCH) ||
+			parse_bt_start(s->reply.ptr, s->reply.size, taskid, len);
+	return res;
+}
+
+static int
+btsearch_list(const char *base, struct session *s, const char *taskid,
+		int offset, struct bt_result **res, int *n, int *finished)
+{
+	char url[SYNO_URL_MAX];
+	int ret;
+
+	*res = NULL;
+	*n = 0;
+	*finished = 0;
+
+	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/btsearch.cgi?"
+			"api=SYNO.DownloadStation.BTSearch&version=1"
+			"&method=list&taskid=%s&offset=%d&limit=100&_sid=%s",
+			base, taskid, offset, s->sid);
+
+	ret = curl_do(url, s, SYNO_OP_BTSEARCH) || parse_bt_list(s->reply.ptr,
+					s->reply.size, res, n, finished);
+
+	if (ret != 0)
+	{
+		free(*res);
+		*res = NULL;
+		*n = 0;
+	}
+
+	return ret;
+}
+
+static int
+btsearch_clean(const char *base, struct session *s, const char *taskid)
+{
+	char url[SYNO_URL_MAX];
+	int res;
+
+	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/btsearch.cgi?"
+			"api=SYNO.DownloadStation.BTSearch&version=1"
+			"&method=clean&taskid=%s&_sid=%s", base, taskid,
+			s->sid);
+
+	res = curl_do(url, s, SYNO_OP_BTSEARCH) ||
+				syno_parse_reply(s->reply.ptr, s->reply.size);
 	return res;
 }
 
+/*
+ * The requests above, sent once more with a new session if the old one
+ * has expired meanwhile
+ */
+
 int
-syno_resume(const char *base, struct session *s, const char *ids)
+syno_list(const char *base, struct session *s,
+			void (*cb)(struct task *t, void *arg), void *arg)
 {
-	char url[1024];
 	int res;
-	struct string st;
 
-	init_string(&st);
+	REPLAYED(res, s, get_list(base, s, cb, arg));
+	return res;
+}
 
-	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
-				"api=SYNO.DownloadStation.Task&version=1"
-				"&method=resume&id=%s&_sid=%s", base, ids,
-				s->sid);
+int
+syno_statistic(const char *base, struct session *s, int *up, int *dn)
+{
+	int res;
+
+	REPLAYED(res, s, get_statistic(base, s, up, dn));
+	return res;
+}
+
+/* reads the speed limits of the server into limits, see enum syno_limit */
+int
+syno_get_limits(const char *base, struct session *s, int *limits)
+{
+	int res;
+
+	REPLAYED(res, s, get_limits(base, s, limits));
+	return res;
+}
+
+/* in KB/s for all kinds of task, 0 for no limit, -1 to leave it */
+int
+syno_set_limits(const char *base, struct session *s, const int *limits)
+{
+	int res;
+
+	REPLAYED(res, s, set_limits(base, s, limits));
+	return res;
+}
 
-	if (curl_do(url, s, &st) != 0)
+/* puts dn into the download limits and up into the upload ones, if >= 0 */
+void
+syno_limits_apply(int *limits, int dn, int up)
+{
+	int i, v;
+
+	for (i = 0; i < SYNO_LIMITS; i++)
 	{
-		free_string(&st);
-		return 1;
+		v = i == SYNO_BT_UP || i == SYNO_EMULE_UP ? up : dn;
+		limits[i] = v >= 0 ? v : limits[i];
 	}
+}
+
+int
+syno_download(const char *base, struct session *s, const char *dl_url)
+{
+	int res;
 
-	res = parse_reply(&st);
-	free_string(&st);
+	REPLAYED(res, s, create_task(base, s, dl_url));
 	return res;
 }
 
 int
-syno_delete(const char *base, struct session *s, const char *ids)
+syno_info(const char *base, struct session *s, const char *id,
+						struct task_info *i)
 {
-	char url[1024];
 	int res;
-	struct string st;
 
-	init_string(&st);
+	REPLAYED(res, s, get_info(base, s, id, i));
+	return res;
+}
 
-	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi?"
-				"api=SYNO.DownloadStation.Task&version=1"
-				"&method=delete&id=%s&_sid=%s"
-				"&force_complete=false", base, ids, s->sid);
+int
+syno_bt_start(const char *base, struct session *s, const char *keyword,
+						char *taskid, int len)
+{
+	int res;
+
+	REPLAYED(res, s, btsearch_start(base, s, keyword, taskid, len));
+	return res;
+}
+
+/* fetches the results from offset on; *res is to be freed by the caller */
+int
+syno_bt_list(const char *base, struct session *s, const char *taskid,
+		int offset, struct bt_result **res, int *n, int *finished)
+{
+	int ret;
+
+	REPLAYED(ret, s, btsearch_list(base, s, taskid, offset, res, n,
+								finished));
+	return ret;
+}
+
+int
+syno_bt_clean(const char *base, struct session *s, const char *taskid)
+{
+	int res;
+
+	REPLAYED(res, s, btsearch_clean(base, s, taskid));
+	return res;
+}
 
-	if (curl_do(url, s, &st) != 0)
+/*
+ * Describes an error code as syno_error() returns it: a DownloadStation API
+ * code, or a curl code negated for failures below the API.
+ */
+const char *
+syno_strerror(int error)
+{
+	int i;
+
+	if (error == -CURLE_ABORTED_BY_CALLBACK)
 	{
-		free_string(&st);
-		return 1;
+		return "Cancelled";
 	}
 
-	res = parse_reply(&st);
-	free_string(&st);
-	return res;
+	if (error < 0)
+	{
+		return curl_easy_strerror(-error);
+	}
+
+	for (i = 0; i < sizeof(api_errors) / sizeof(api_errors[0]); i++)
+	{
+		if (api_errors[i].code == error)
+		{
+			return api_errors[i].text;
+		}
+	}
+
+	return "Request failed";
+}
+
+/* a file on its way to the NAS */
+struct upload
+{
+	CURL *curl;
+	curl_mime *mime;
+	struct syno_buf st;
+	int file;
+};
+
+static int
+upload_start(CURLM *multi, const char *base, struct session *s,
+				const char *file, struct upload *u)
+{
+	char url[SYNO_URL_MAX];
+	curl_mimepart *part;
+	struct stat sb;
+
+	/* curl would only find out once it is too late to say why */
+	if (stat(file, &sb) != 0 || !S_ISREG(sb.st_mode))
+	{
+		return -CURLE_READ_ERROR;
+	}
+
+	if (!(u->curl = curl_easy_init()) || reset_buf(&u->st) != 0)
+	{
+		fprintf(stderr, "Failed to initialize CURL\n");
+		curl_easy_cleanup(u->curl);
+		u->curl = NULL;
+		return -CURLE_FAILED_INIT;
+	}
+
+	syno_setup_handle(u->curl);
+	u->mime = curl_mime_init(u->curl);
+
+	part = curl_mime_addpart(u->mime);
+	curl_mime_name(part, "api");
+	curl_mime_data(part, "SYNO.DownloadStation.Task", CURL_ZERO_TERMINATED);
+	part = curl_mime_addpart(u->mime);
+	curl_mime_name(part, "version");
+	curl_mime_data(part, "1", CURL_ZERO_TERMINATED);
+	part = curl_mime_addpart(u->mime);
+	curl_mime_name(part, "method");
+	curl_mime_data(part, "create", CURL_ZERO_TERMINATED);
+	part = curl_mime_addpart(u->mime);
+	curl_mime_name(part, "_sid");
+	curl_mime_data(part, s->sid, CURL_ZERO_TERMINATED);
+
+	/* read from disk while it is sent; DownloadStation wants it last */
+	part = curl_mime_addpart(u->mime);
+	curl_mime_name(part, "file");
+	curl_mime_filedata(part, file);
+
+	snprintf(url, sizeof(url), "%s/webapi/DownloadStation/task.cgi", base);
+
+	curl_easy_setopt(u->curl, CURLOPT_URL, url);
+	curl_easy_setopt(u->curl, CURLOPT_MIMEPOST, u->mime);
+	curl_easy_setopt(u->curl, CURLOPT_WRITEFUNCTION, curl_recv);
+	curl_easy_setopt(u->curl, CURLOPT_WRITEDATA, &u->st);
+	curl_easy_setopt(u->curl, CURLOPT_PRIVATE, u);
+	curl_easy_setopt(u->curl, CURLOPT_CONNECTTIMEOUT_MS,
+					s->timeouts[SYNO_OP_CREATE].connect);
+	curl_easy_setopt(u->curl, CURLOPT_TIMEOUT_MS,
+					s->timeouts[SYNO_OP_CREATE].total);
+
+	curl_multi_add_handle(multi, u->curl);
+	return 0;
+}
+
+/* returns 0 or the error, like session.error */
+static int
+upload_finish(CURLM *multi, struct upload *u, CURLcode res)
+{
+	long code;
+	int error;
+
+	code = 0;
+	curl_easy_getinfo(u->curl, CURLINFO_RESPONSE_CODE, &code);
+
+	if (res != CURLE_OK)
+	{
+		fprintf(stderr, "curl_easy_perform() failed: %s\n",
+						curl_easy_strerror(res));
+		error = -res;
+	}
+	else if (code >= 400)
+	{
+		fprintf(stderr, "Server error %ld\n", code);
+		error = -CURLE_HTTP_RETURNED_ERROR;
+	}
+	else
+	{
+		api_error = 0;
+		error = syno_parse_reply(u->st.ptr, u->st.size) ? api_error : 0;
+	}
+
+	curl_multi_remove_handle(multi, u->curl);
+	curl_easy_cleanup(u->curl);
+	curl_mime_free(u->mime);
+	return error;
+}
+
+/* what has gone out so far, for the progress callback */
+static int64_t
+upload_sent(struct upload *ups)
+{
+	curl_off_t sent;
+	int64_t total;
+	int i;
+
+	for (i = 0, total = 0; i < UPLOADS; i++)
+	{
+		sent = 0;
+
+		if (ups[i].curl)
+		{
+			curl_easy_getinfo(ups[i].curl, CURLINFO_SIZE_UPLOAD_T,
+									&sent);
+		}
+
+		total += sent;
+	}
+
+	return total;
+}
+
+/* sends the files whose result is -1, setting it to 0 or the error */
+static void
+upload(const char *base, struct session *s, char *const *files, int n,
+								int *res)
+{
+	struct upload ups[UPLOADS], *u;
+	CURLMsg *msg;
+	CURLM *multi;
+	double start;
+	int i, next, active, left, err;
+
+	/* kept with the session, along with its connections to the NAS */
+	if (curl_handle(s) && !s->multi && (s->multi = curl_multi_init()))
+	{
+		/* several files go through one HTTP/2 connection if possible */
+		curl_multi_setopt(s->multi, CURLMOPT_PIPELINING,
+							CURLPIPE_MULTIPLEX);
+	}
+
+	if (!(multi = s->multi))
+	{
+		fprintf(stderr, "Failed to initialize CURL\n");
+
+		for (i = 0; i < n; i++)
+		{
+			res[i] = res[i] == -1 ? -CURLE_FAILED_INIT : res[i];
+		}
+
+		return;
+	}
+
+	memset(ups, 0, sizeof(ups));
+
+	start = now_ms();
+	next = 0;
+	active = 0;
+
+	do
+	{
+		/* keep every slot busy while there are files left */
+		for (i = 0; i < UPLOADS; i++)
+		{
+			while (!ups[i].curl && next < n)
+			{
+				if (res[next] != -1)
+				{
+					next++;
+					continue;
+				}
+
+				ups[i].file = next;
+				err = upload_start(multi, base, s, files[next],
+								&ups[i]);
+
+				if (err != 0)
+					res[next] = err;
+				else
+					active++;
+
+				next++;
+			}
+		}
+
+		curl_multi_perform(multi, &left);
+		curl_multi_wait(multi, NULL, 0, 100, NULL);
+		curl_multi_perform(multi, &left);
+
+		while ((msg = curl_multi_info_read(multi, &left)))
+		{
+			if (msg->msg != CURLMSG_DONE)
+			{
+				continue;
+			}
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+								(char **) &u);
+			res[u->file] = upload_finish(multi, u,
+							msg->data.result);
+			u->curl = NULL;
+			active--;
+		}
+
+		/* given up on: what is on its way is dropped, the rest not sent */
+		if (s->progress && s->progress(s->progress_arg,
+			upload_sent(ups), (now_ms() - start) / 1000))
+		{
+			for (i = 0; i < UPLOADS; i++)
+			{
+				if (ups[i].curl)
+				{
+					res[ups[i].file] = upload_finish(multi,
+					&ups[i], CURLE_ABORTED_BY_CALLBACK);
+					ups[i].curl = NULL;
+				}
+			}
+
+			for (; next < n; next++)
+			{
+				res[next] = res[next] == -1 ?
+					-CURLE_ABORTED_BY_CALLBACK : res[next];
+			}
+
+			active = 0;
+		}
+	} while (active > 0 || next < n);
+
+	for (i = 0; i < UPLOADS; i++)
+	{
+		free_buf(&ups[i].st);
+	}
+}
+
+/*
+ * Adds .torrent/.nzb files as download tasks, streaming them from disk,
+ * several at a time. res gets 0 or the error of each file (see
+ * syno_strerror()); returns the number of files that failed.
+ */
+int
+syno_upload(const char *base, struct session *s, char *const *files,
+							int n, int *res)
+{
+	int i, failed, lost;
+
+	for (i = 0; i < n; i++)
+	{
+		res[i] = -1;
+	}
+
+	upload(base, s, files, n, res);
+
+	for (i = 0, lost = 0; i < n; i++)
+	{
+		lost += session_lost(res[i]);
+	}
+
+	/* once more for those the expired session got rejected */
+	if (lost && s->relogin && s->relogin(s, s->relogin_arg) == 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			res[i] = session_lost(res[i]) ? -1 : res[i];
+		}
+
+		upload(base, s, files, n, res);
+	}
+
+	for (i = 0, failed = 0; i < n; i++)
+	{
+		failed += res[i] != 0;
+	}
+
+	s->stats.error = 0;
+
+	for (i = 0; i < n && !s->stats.error; i++)
+	{
+		s->stats.error = res[i];
+	}
+
+	return failed;
 }
@@ -23,9 +23,54 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <inttypes.h>
 
-struct session
+/* size of the request URLs, ids beyond that need another request */
+#define SYNO_URL_MAX 1024
+
+/* returned by syno_list() when the task list is the same as last time */
+#define SYNO_UNCHANGED 2
+
+/* the kinds of request, each with deadlines of its own */
+enum syno_op
+{
+	SYNO_OP_LOGIN,
+	SYNO_OP_LIST,
+	SYNO_OP_STATISTIC,
+	SYNO_OP_TASK,		/* pause, resume, delete */
+	SYNO_OP_CREATE,
+	SYNO_OP_INFO,
+	SYNO_OP_BTSEARCH,
+	SYNO_OP_CONFIG,		/* server settings */
+	SYNO_OPS
+};
+
+/* the speed limits of the server, each in KB/s with 0 for none */
+enum syno_limit
 {
-	char sid[24];
+	SYNO_BT_DN,
+	SYNO_BT_UP,
+	SYNO_EMULE_DN,
+	SYNO_EMULE_UP,
+	SYNO_NZB_DN,
+	SYNO_HTTP_DN,
+	SYNO_FTP_DN,
+	SYNO_LIMITS
+};
+
+/*
+ * The client context: a login plus the connections and buffers used to
+ * talk to one DiskStation, made by syno_new() and released with
+ * syno_free(). A session is used by one thread at a time; threads with
+ * sessions of their own do not get in each other's way.
+ */
+struct session;
+
+/* what the last request of a session took */
+struct syno_stats
+{
+	int64_t wire_bytes;	/* received, on the wire */
+	int64_t body_bytes;	/* ... and after content decoding */
+	double elapsed;		/* seconds */
+	int error;		/* API code, -CURLcode or 0 */
 };
 
 struct task
@@ -33,19 +78,129 @@ struct task
 	char id[16];
 	char fn[128];
 	char status[32];
+	char type[8];
 	int64_t size;
 	int64_t downloaded;
 	int64_t uploaded;
 	int speed_dn;
 	int speed_up;
 	int percent_dn;
+	uint64_t fp;	/* fingerprint of all of the above */
+};
+
+struct task_file
+{
+	char name[256];
+	int64_t size;
+	int64_t downloaded;
+	char priority[16];
 };
 
+struct task_peer
+{
+	char address[64];
+	char agent[64];
+	double progress;
+	int speed_dn;
+	int speed_up;
+};
+
+struct task_tracker
+{
+	char url[256];
+	char status[64];
+	int seeds;
+	int peers;
+};
+
+/* everything getinfo knows about a task */
+struct task_info
+{
+	struct task t;
+	char destination[256];
+	char uri[512];
+	int64_t created;
+	int seeders;
+	int leechers;
+	int total_peers;
+	struct task_file *files;
+	int nfiles;
+	struct task_peer *peers;
+	int npeers;
+	struct task_tracker *trackers;
+	int ntrackers;
+};
+
+/* a BitTorrent search hit */
+struct bt_result
+{
+	char title[256];
+	char uri[1024];
+	char provider[32];
+	char date[32];
+	int64_t size;
+	int seeds;
+	int leechs;
+};
+
+struct session *syno_new();
+void syno_free(struct session *s);
+const char *syno_sid(const struct session *s);
+void syno_set_sid(struct session *s, const char *sid);
+int syno_error(const struct session *s);
+void syno_stats(const struct session *s, struct syno_stats *stats);
+/* the next list is fetched in full, even if it has not changed */
+void syno_forget(struct session *s);
+/* relogin gets a new sid when the server has dropped ours, 0 on success */
+void syno_set_relogin(struct session *s,
+		int (*relogin)(struct session *s, void *arg), void *arg);
+/* progress is called while a request runs, returning 1 cancels it */
+void syno_set_progress(struct session *s,
+		int (*progress)(void *arg, int64_t bytes, double elapsed),
+		void *arg);
+void syno_set_timeout(struct session *s, enum syno_op op, int connect_ms,
+							int total_ms);
+const char *syno_op_name(enum syno_op op);
+
 int syno_login(const char *b, struct session *s, const char *u, const char *p);
-int syno_list(const char *base, struct session *s, void (*cb)(struct task *));
+/* cb sees each task along with arg, it must not make requests on s */
+int syno_list(const char *base, struct session *s,
+			void (*cb)(struct task *t, void *arg), void *arg);
+int syno_statistic(const char *base, struct session *s, int *up, int *dn);
 int syno_download(const char *base, struct session *s, const char *dl_url);
+int syno_upload(const char *base, struct session *s, char *const *files,
+							int n, int *res);
+int syno_get_limits(const char *base, struct session *s, int *limits);
+/* limits has SYNO_LIMITS entries, -1 leaves that one as it is */
+int syno_set_limits(const char *base, struct session *s, const int *limits);
+void syno_limits_apply(int *limits, int dn, int up);
 int syno_logout(const char *base, struct session *s);
 int syno_pause(const char *base, struct session *s, const char *ids);
 int syno_resume(const char *base, struct session *s, const char *ids);
 int syno_delete(const char *base, struct session *s, const char *ids);
+int syno_info(const char *base, struct session *s, const char *id,
+						struct task_info *info);
+void syno_info_free(struct task_info *info);
+int syno_bt_start(const char *base, struct session *s, const char *keyword,
+						char *taskid, int len);
+int syno_bt_list(const char *base, struct session *s, const char *taskid,
+		int offset, struct bt_result **res, int *n, int *finished);
+int syno_bt_clean(const char *base, struct session *s, const char *taskid);
+const char *syno_strerror(int error);
+
+/* for callers that drive their own transfers (e.g. synodl-load) */
+void syno_setup_handle(void *curl);
+void syno_login_url(char *url, int len, const char *base, const char *u,
+							const char *pw);
+void syno_logout_url(char *url, int len, const char *base, struct session *s);
+void syno_list_url(char *url, int len, const char *base, struct session *s);
+int syno_task_url(char *url, int len, const char *base, struct session *s,
+					const char *method, const char *ids);
+int syno_create_url(char *url, int len, const char *base, struct session *s,
+							const char *uris);
+int syno_parse_login(const char *buf, int len, struct session *s);
+int syno_parse_tasks(const char *buf, int len,
+			void (*cb)(struct task *t, void *arg), void *arg);
+int syno_parse_reply(const char *buf, int len);
+
 #endif
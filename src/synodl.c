@@ -23,37 +23,183 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "config.h"
 #include "cfg.h"
+#include "follow.h"
+#include "nas.h"
+#include "stall.h"
 #include "syno.h"
+#include "tasks.h"
+#include "tlog.h"
 #include "ui.h"
+#include "watch.h"
 
 void help()
 {
-	printf("Syntax: synodl [options] [URL]\n\n");
+	printf("Syntax: synodl [options] [URL]\n");
+	printf("       synodl --upload FILE...\n");
+	printf("       synodl --watch-dir DIR\n");
+	printf("       synodl --watch\n\n");
 	printf("If URL is empty a list of current download tasks is shown,\n");
 	printf("otherwise the URL is added as a download task.\n\n");
 	printf("  -h           Show this help\n");
+	printf("  --upload     Add the given .torrent/.nzb files as tasks\n");
+	printf("  --watch      Print the tasks as JSON lines, then their changes\n");
+	printf("  --watch-dir DIR\n");
+	printf("               Keep adding files dropped into DIR as tasks\n");
+	printf("  --history    Summarize the transfer history and exit\n");
+	printf("  --since AGE  Only look at the last AGE of history, e.g. 7d,\n");
+	printf("               12h or 30m\n");
 	printf("\n");
 	printf("This is %s.\n", PACKAGE_STRING);
 	printf("Report bugs at https://github.com/cockroach/synodl/\n");
 }
 
+/* sends local files to the first DiskStation, without the UI */
+static int
+upload_files(struct cfg *config, char *const *files, int n)
+{
+	struct cfg_nas *nas;
+	struct session *s;
+	int *res, i, failed;
+
+	nas = &config->nas[0];
+
+	if (!(res = calloc(n, sizeof(int))))
+	{
+		fprintf(stderr, "Calloc failed\n");
+		return 1;
+	}
+
+	if (!(s = config_session(config)))
+	{
+		free(res);
+		return 1;
+	}
+
+	if (syno_login(nas->url, s, nas->user, nas->pw) != 0)
+	{
+		syno_free(s);
+		free(res);
+		return 1;
+	}
+
+	failed = syno_upload(nas->url, s, files, n, res);
+
+	for (i = 0; i < n; i++)
+	{
+		if (res[i] != 0)
+			fprintf(stderr, "Failed to upload %s: %s\n", files[i],
+							syno_strerror(res[i]));
+		else
+			printf("Added %s\n", files[i]);
+	}
+
+	syno_logout(nas->url, s);
+	syno_free(s);
+	free(res);
+
+	return failed != 0;
+}
+
+/* summarizes the transfer history, tasks named by their DiskStation */
+static int
+query_history(struct cfg *config, time_t since)
+{
+	const char *names[CFG_NAS_MAX];
+	int i;
+
+	for (i = 0; i < config->nas_count; i++)
+	{
+		names[i] = config->nas[i].name;
+	}
+
+	return tlog_query(config->history, since, names, config->nas_count);
+}
+
+/* what restarting stalled tasks has brought */
+static void
+stall_summary()
+{
+	struct stall_stats st;
+
+	stall_stats(&st);
+
+	if (st.detected == 0)
+	{
+		return;
+	}
+
+	printf("Stalled tasks: %d seen, %d restarted, %d downloading again, "
+		"%.1f MB downloaded since\n", st.detected, st.restarted,
+		st.recovered, st.reclaimed / 1048576.0);
+}
+
+/* "7d", "12h", "30m" or "90s" in seconds, -1 if it is none of these */
+static long
+parse_age(const char *str)
+{
+	char *end;
+	double val;
+
+	val = strtod(str, &end);
+
+	if (end == str || val < 0)
+	{
+		return -1;
+	}
+
+	switch (*end)
+	{
+	case 'd':
+		val *= 24;
+		/* fall through */
+	case 'h':
+		val *= 60;
+		/* fall through */
+	case 'm':
+		val *= 60;
+		/* fall through */
+	case 's':
+		end++;
+		break;
+	default:
+		return -1;
+	}
+
+	return *end ? -1 : (long) val;
+}
+
 int main(int argc, char **argv)
 {
-	int c, option_idx;
-	const char *url;
+	int c, option_idx, history, upload, follow;
+	long since;
+	const char *url, *watch;
 	struct cfg config;
-	struct session s;
+	static struct option options[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "history", no_argument, NULL, 'H' },
+		{ "since", required_argument, NULL, 'S' },
+		{ "upload", no_argument, NULL, 'U' },
+		{ "watch-dir", required_argument, NULL, 'W' },
+		{ "watch", no_argument, NULL, 'w' },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	setlocale(LC_ALL, "");
 
 	memset(&config, 0, sizeof(struct cfg));
+	history = 0;
+	upload = 0;
+	follow = 0;
+	watch = NULL;
+	since = 0;
 
 	while (1)
 	{
-		c = getopt(argc, argv, "h");
+		c = getopt_long(argc, argv, "h", options, &option_idx);
 
 		if (c < 0)
 		{
@@ -72,6 +218,25 @@ int main(int argc, char **argv)
 		case 'h':
 			help();
 			return EXIT_SUCCESS;
+		case 'H':
+			history = 1;
+			break;
+		case 'U':
+			upload = 1;
+			break;
+		case 'W':
+			watch = optarg;
+			break;
+		case 'w':
+			follow = 1;
+			break;
+		case 'S':
+			if ((since = parse_age(optarg)) < 0)
+			{
+				fprintf(stderr, "Invalid age: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		default:
 			help();
 			return EXIT_FAILURE;
@@ -84,9 +249,51 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	memset(&s, 0, sizeof(struct session));
+	if (history)
+	{
+		if (!strcmp(config.history, ""))
+		{
+			fprintf(stderr, "No history file in configuration file\n");
+			return EXIT_FAILURE;
+		}
+
+		return query_history(&config, since ? time(NULL) - since : 0)
+				== 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (upload)
+	{
+		if (optind == argc)
+		{
+			fprintf(stderr, "No files to upload\n");
+			return EXIT_FAILURE;
+		}
+
+		return upload_files(&config, argv + optind, argc - optind)
+				== 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (follow)
+	{
+		return follow_tasks(&config) == 0 ? EXIT_SUCCESS :
+								EXIT_FAILURE;
+	}
+
+	if (watch)
+	{
+		return watch_dir(&config, watch) == 0 ? EXIT_SUCCESS :
+								EXIT_FAILURE;
+	}
+
+	/* a refresh may come late, but not twice as late */
+	if (strcmp(config.history, "") && tlog_open(config.history,
+					2 * config.poll_max / 1000) != 0)
+	{
+		return EXIT_FAILURE;
+	}
 
-	if (syno_login(config.url, &s, config.user, config.pw) != 0)
+	/* logs in to all of them in the background */
+	if (nas_start(&config) != 0)
 	{
 		return EXIT_FAILURE;
 	}
@@ -96,14 +303,16 @@ int main(int argc, char **argv)
 	if (optind < argc)
 	{
 		url = argv[optind];
-		ui_add_task(config.url, &s, url);
+		ui_add_task(url);
 	}
 
-	main_loop(config.url, &s);
+	main_loop(&config);
 
-	syno_logout(config.url, &s);
 	free_ui();
+	stall_summary();
+	nas_stop();
 	tasks_free();
+	tlog_close();
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,649 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE	/* strcasestr */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+#include "syno.h"
+#include "tasks.h"
+
+struct tasklist_ent *tasks;
+struct view view;
+
+const char *sort_names[] = { "arrival", "name", "size", "progress", "speed",
+							"ETA", "status" };
+const char *filter_names[] = { "all", "active", "paused", "done", "error" };
+
+/* id -> entry, so a refresh can update rows in place */
+static struct tasklist_ent **task_index;
+static int index_size, task_count;
+
+/* entries not seen in the current generation are gone from the server */
+static int generation;
+static unsigned int next_seq;
+
+/*
+	Index
+*/
+
+static unsigned int
+index_hash(int nas, const char *id)
+{
+	unsigned int h = 2166136261u ^ nas;
+
+	while (*id)
+	{
+		h ^= (unsigned char) *id++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static void
+index_link(struct tasklist_ent *ent)
+{
+	struct tasklist_ent **bucket;
+
+	bucket = &task_index[index_hash(ent->nas, ent->t->id) &
+							(index_size - 1)];
+	ent->hnext = *bucket;
+	*bucket = ent;
+}
+
+static int
+index_add(struct tasklist_ent *ent)
+{
+	struct tasklist_ent **old, *tmp;
+	int i, old_size;
+
+	if (task_count >= index_size / 2)
+	{
+		old = task_index;
+		old_size = index_size;
+
+		index_size = index_size ? index_size * 2 : 256;
+		task_index = calloc(index_size, sizeof(struct tasklist_ent *));
+
+		if (!task_index)
+		{
+			task_index = old;
+			index_size = old_size;
+			return 1;
+		}
+
+		for (i = 0; i < old_size; i++)
+		{
+			while ((tmp = old[i]))
+			{
+				old[i] = tmp->hnext;
+				index_link(tmp);
+			}
+		}
+
+		free(old);
+	}
+
+	index_link(ent);
+	task_count += 1;
+	return 0;
+}
+
+static void
+index_remove(struct tasklist_ent *ent)
+{
+	struct tasklist_ent **p;
+
+	p = &task_index[index_hash(ent->nas, ent->t->id) &
+							(index_size - 1)];
+
+	while (*p && *p != ent)
+	{
+		p = &(*p)->hnext;
+	}
+
+	if (*p)
+	{
+		*p = ent->hnext;
+		task_count -= 1;
+	}
+}
+
+/*
+	Task list
+*/
+
+void
+tasks_free()
+{
+	struct tasklist_ent *ent, *tmp;
+
+	ent = tasks;
+
+	while (ent)
+	{
+		tmp = ent;
+		ent = ent->next;
+
+		free(tmp->t);
+		free(tmp);
+	}
+
+	free(task_index);
+	free(view.ents);
+	search_free();
+
+	tasks = NULL;
+	task_index = NULL;
+	index_size = 0;
+	task_count = 0;
+
+	view.ents = NULL;
+	view.len = 0;
+	view.cap = 0;
+}
+
+void
+tasks_add(int nas, struct task *t)
+{
+	struct tasklist_ent *ent = malloc(sizeof(struct tasklist_ent));
+
+	if (!ent)
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return;
+	}
+
+	ent->t = malloc(sizeof(struct task));
+
+	if (!ent->t)
+	{
+		fprintf(stderr, "Malloc failed\n");
+		free(ent);
+		return;
+	}
+
+	memcpy(ent->t, t, sizeof(struct task));
+	ent->nas = nas;
+
+	if (index_add(ent) != 0)
+	{
+		fprintf(stderr, "Malloc failed\n");
+		free(ent->t);
+		free(ent);
+		return;
+	}
+
+	ent->next = tasks;
+	ent->prev = NULL;
+	ent->seq = next_seq++;
+	ent->rank = ent->seq;
+	ent->queued = 0;
+	ent->switched = 0;
+	ent->progress = t->downloaded;
+	ent->progress_at = 0;
+	ent->stalled = 0;
+	ent->cycling = 0;
+	ent->rescued = -1;
+	ent->recovered = 0;
+	ent->done_at = 0;
+	ent->expired = 0;
+	ent->seen = generation;
+	ent->dirty = 1;
+	ent->moved = 1;
+	ent->marked = 0;
+	ent->pos = -1;
+	memset(&ent->hist, 0, sizeof(struct history));
+	search_add(ent);
+
+	if (tasks)
+	{
+		tasks->prev = ent;
+	}
+
+	tasks = ent;
+}
+
+struct tasklist_ent *
+tasks_find(int nas, const char *id)
+{
+	struct tasklist_ent *ent;
+
+	if (!task_index)
+	{
+		return NULL;
+	}
+
+	ent = task_index[index_hash(nas, id) & (index_size - 1)];
+
+	while (ent && (ent->nas != nas || strcmp(ent->t->id, id)))
+	{
+		ent = ent->hnext;
+	}
+
+	return ent;
+}
+
+/* list callback: merges a task of the NAS arg points to into the list */
+void
+tasks_update(struct task *t, void *arg)
+{
+	struct tasklist_ent *ent;
+	int nas = *(int *) arg;
+	int renamed;
+
+	if (!(ent = tasks_find(nas, t->id)))
+	{
+		tasks_add(nas, t);
+		return;
+	}
+
+	if (ent->t->fp != t->fp)
+	{
+		renamed = strcmp(ent->t->fn, t->fn);
+
+		/* only a new title needs to be indexed again */
+		if (renamed)
+		{
+			search_remove(ent);
+		}
+
+		memcpy(ent->t, t, sizeof(struct task));
+
+		if (renamed)
+		{
+			search_add(ent);
+		}
+
+		ent->dirty = 1;
+		ent->moved = 1;
+	}
+
+	ent->seen = generation;
+}
+
+void
+tasks_remove(struct tasklist_ent *ent)
+{
+	if (ent->prev)
+	{
+		ent->prev->next = ent->next;
+	}
+	else
+	{
+		tasks = ent->next;
+	}
+
+	if (ent->next)
+	{
+		ent->next->prev = ent->prev;
+	}
+
+	if (ent->pos >= 0)
+	{
+		view.ents[ent->pos] = NULL;
+		view.holes = 1;
+	}
+
+	index_remove(ent);
+	search_remove(ent);
+	free(ent->t);
+	free(ent);
+}
+
+/* starts a refresh from a NAS, i.e. a series of tasks_update() calls */
+void
+tasks_begin()
+{
+	generation += 1;
+}
+
+/* drops the tasks of that NAS the last refresh no longer reported */
+void
+tasks_sweep(int nas, void (*gone)(struct tasklist_ent *ent, void *arg),
+								void *arg)
+{
+	struct tasklist_ent *ent, *tmp;
+
+	ent = tasks;
+
+	while (ent)
+	{
+		tmp = ent;
+		ent = ent->next;
+
+		if (tmp->nas != nas || tmp->seen == generation)
+		{
+			continue;
+		}
+
+		gone(tmp, arg);
+		tasks_remove(tmp);
+	}
+}
+
+/* records the current speed of every task after a refresh */
+void
+tasks_sample()
+{
+	struct tasklist_ent *ent;
+	double rate;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		rate = ent->hist.rate;
+		history_push(&ent->hist, ent->t->speed_dn);
+
+		if (ent->hist.rate == rate)
+		{
+			continue;
+		}
+
+		/* the ETA column follows the smoothed rate */
+		ent->dirty = 1;
+
+		if (view.key == SORT_ETA)
+		{
+			ent->moved = 1;
+		}
+	}
+}
+
+/*
+	View
+*/
+
+static int
+status_class(const char *status)
+{
+	if (!strcmp(status, "paused"))
+		return FILTER_PAUSED;
+	else if (!strcmp(status, "finished") || !strcmp(status, "seeding"))
+		return FILTER_DONE;
+	else if (!strcmp(status, "downloading") ||
+				!strcmp(status, "waiting") ||
+				!strcmp(status, "finishing") ||
+				!strcmp(status, "hash_checking") ||
+				!strcmp(status, "filehosting_waiting") ||
+				!strcmp(status, "extracting"))
+		return FILTER_ACTIVE;
+	else
+		return FILTER_ERROR;
+}
+
+static int
+view_match(struct tasklist_ent *ent)
+{
+	if (view.filter != FILTER_ALL &&
+				status_class(ent->t->status) != view.filter)
+	{
+		return 0;
+	}
+
+	if (view.text[0] && !strcasestr(ent->t->fn, view.text))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+/* seconds until done, or -1 if it is not moving */
+static double
+eta(struct tasklist_ent *ent)
+{
+	return history_eta(&ent->hist, ent->t->size - ent->t->downloaded);
+}
+
+static int
+cmp_num(double a, double b)
+{
+	return (a > b) - (a < b);
+}
+
+static int
+view_cmp(const void *pa, const void *pb)
+{
+	struct tasklist_ent *a = *(struct tasklist_ent **) pa;
+	struct tasklist_ent *b = *(struct tasklist_ent **) pb;
+	double ea, eb;
+	int res;
+
+	switch (view.key)
+	{
+	case SORT_NAME:
+		res = strcasecmp(a->t->fn, b->t->fn);
+		break;
+	case SORT_SIZE:
+		res = -cmp_num(a->t->size, b->t->size);
+		break;
+	case SORT_PROGRESS:
+		res = -cmp_num(a->t->percent_dn, b->t->percent_dn);
+		break;
+	case SORT_SPEED:
+		res = -cmp_num(a->t->speed_dn, b->t->speed_dn);
+		break;
+	case SORT_ETA:
+		/* stalled tasks go last */
+		ea = eta(a);
+		eb = eta(b);
+		res = (ea < 0) - (eb < 0);
+		res = res ? res : cmp_num(ea, eb);
+		break;
+	case SORT_STATUS:
+		res = cmp_num(status_class(a->t->status),
+						status_class(b->t->status));
+		res = res ? res : strcmp(a->t->status, b->t->status);
+		break;
+	default:
+		res = 0;
+		break;
+	}
+
+	if (view.reverse)
+	{
+		res = -res;
+	}
+
+	/* newest first, as the list always used to be */
+	return res ? res : cmp_num(b->seq, a->seq);
+}
+
+static int
+view_reserve(int n)
+{
+	struct tasklist_ent **tmp;
+
+	if (n <= view.cap)
+	{
+		return 0;
+	}
+
+	tmp = realloc(view.ents, n * 2 * sizeof(struct tasklist_ent *));
+
+	if (!tmp)
+	{
+		fprintf(stderr, "Realloc failed\n");
+		return 1;
+	}
+
+	view.ents = tmp;
+	view.cap = n * 2;
+	return 0;
+}
+
+static int
+view_rebuild()
+{
+	struct tasklist_ent *ent;
+	int i;
+
+	if (view_reserve(task_count) != 0)
+	{
+		return 0;
+	}
+
+	view.len = 0;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		ent->moved = 0;
+		ent->pos = -1;
+
+		if (view_match(ent))
+		{
+			view.ents[view.len++] = ent;
+		}
+	}
+
+	qsort(view.ents, view.len, sizeof(struct tasklist_ent *), view_cmp);
+
+	for (i = 0; i < view.len; i++)
+	{
+		view.ents[i]->pos = i;
+	}
+
+	view.stale = 0;
+	view.holes = 0;
+	return 1;
+}
+
+/*
+ * Brings the view up to date with the task list. Only the entries that
+ * changed since the last call are sorted, then merged into the rest of the
+ * view, which is still in order. Returns 1 if any row moved.
+ */
+int
+view_update()
+{
+	static struct tasklist_ent **changed;
+	static int changed_cap;
+	struct tasklist_ent *ent, **tmp;
+	int i, n, k, w, moved;
+
+	if (view.stale)
+	{
+		return view_rebuild();
+	}
+
+	k = 0;
+	moved = view.holes;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (!ent->moved)
+		{
+			continue;
+		}
+
+		if (k == changed_cap)
+		{
+			changed_cap = changed_cap ? changed_cap * 2 : 64;
+			tmp = realloc(changed, changed_cap * sizeof(*changed));
+
+			if (!tmp)
+			{
+				fprintf(stderr, "Realloc failed\n");
+				view.stale = 1;
+				return view_rebuild();
+			}
+
+			changed = tmp;
+		}
+
+		/* take it out, the merge below puts it back if it matches */
+		if (ent->pos >= 0)
+		{
+			view.ents[ent->pos] = NULL;
+		}
+
+		ent->moved = 0;
+		changed[k++] = ent;
+	}
+
+	if (k == 0 && !view.holes)
+	{
+		return 0;
+	}
+
+	for (i = 0, n = 0; i < view.len; i++)
+	{
+		if (view.ents[i])
+		{
+			view.ents[n++] = view.ents[i];
+		}
+	}
+
+	for (i = 0, w = 0; i < k; i++)
+	{
+		if (view_match(changed[i]))
+		{
+			changed[w++] = changed[i];
+		}
+		else if (changed[i]->pos >= 0)
+		{
+			changed[i]->pos = -1;
+			moved = 1;
+		}
+	}
+
+	k = w;
+
+	if (view_reserve(n + k) != 0)
+	{
+		view.stale = 1;
+		return 0;
+	}
+
+	qsort(changed, k, sizeof(struct tasklist_ent *), view_cmp);
+	view.len = n + k;
+
+	/* merge from the back so that it can happen in place */
+	i = n - 1;
+	w = n + k - 1;
+
+	while (k > 0)
+	{
+		if (i >= 0 && view_cmp(&view.ents[i], &changed[k - 1]) > 0)
+		{
+			view.ents[w--] = view.ents[i--];
+		}
+		else
+		{
+			view.ents[w--] = changed[--k];
+		}
+	}
+
+	for (i = 0; i < view.len; i++)
+	{
+		if (view.ents[i]->pos != i)
+		{
+			view.ents[i]->pos = i;
+			moved = 1;
+		}
+	}
+
+	view.holes = 0;
+	return moved;
+}
@@ -0,0 +1,111 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_TASKS_H
+#define __SYNODL_TASKS_H
+
+#include <time.h>
+
+#include "history.h"
+#include "syno.h"
+
+struct tasklist_ent
+{
+	struct task *t;
+	int nas;	/* index of the DiskStation it is on */
+	struct tasklist_ent *next;
+	struct tasklist_ent *prev;
+	struct tasklist_ent *hnext;	/* next in index bucket */
+	unsigned int seq;	/* order of arrival */
+	int rank;	/* place in the queue, lower goes first */
+	int queued;	/* paused by the queue manager */
+	time_t switched;	/* when it last paused or resumed it */
+	int64_t progress;	/* bytes downloaded when last seen to move */
+	time_t progress_at;
+	int stalled;	/* downloading, but not moving */
+	int cycling;	/* paused to be resumed */
+	int64_t rescued;	/* bytes when restarted for stalling, or -1 */
+	int recovered;	/* moving since */
+	time_t done_at;	/* first seen finished or seeding */
+	int expired;	/* due to be cleaned up */
+	int seen;	/* refresh generation that last reported it */
+	int dirty;	/* needs to be repainted */
+	int moved;	/* needs to be re-positioned in the view */
+	int marked;
+	int pos;	/* index in the view, -1 if filtered out */
+	unsigned int hit;	/* search that matched it */
+	char fold[128];	/* case-folded title, for searching */
+	struct history hist;
+};
+
+enum sort_key
+{
+	SORT_NONE,
+	SORT_NAME,
+	SORT_SIZE,
+	SORT_PROGRESS,
+	SORT_SPEED,
+	SORT_ETA,
+	SORT_STATUS,
+	SORT_KEYS
+};
+
+enum status_filter
+{
+	FILTER_ALL,
+	FILTER_ACTIVE,
+	FILTER_PAUSED,
+	FILTER_DONE,
+	FILTER_ERROR,
+	FILTERS
+};
+
+/* the tasks that pass the filter, in display order */
+struct view
+{
+	struct tasklist_ent **ents;
+	int len;
+	int cap;
+	enum sort_key key;
+	int reverse;
+	enum status_filter filter;
+	char text[64];
+	int stale;	/* sorting or filter changed */
+	int holes;	/* entries were removed */
+};
+
+extern struct tasklist_ent *tasks;
+extern struct view view;
+extern const char *sort_names[];
+extern const char *filter_names[];
+
+void tasks_free();
+void tasks_add(int nas, struct task *t);
+void tasks_update(struct task *t, void *arg);
+void tasks_remove(struct tasklist_ent *ent);
+struct tasklist_ent *tasks_find(int nas, const char *id);
+void tasks_begin();
+void tasks_sweep(int nas, void (*gone)(struct tasklist_ent *ent, void *arg),
+								void *arg);
+void tasks_sample();
+
+int view_update();
+
+#endif
@@ -0,0 +1,823 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tlog.h"
+
+/*
+ * The transfer log is a header followed by fixed-size records, appended
+ * after every refresh. Records are in time order, which lets queries find
+ * their start by bisection in a memory map. Once records are a day old
+ * they are merged into 5-minute buckets, after 30 days into hours. Tasks
+ * are told apart by DiskStation and id, ids are only unique on one box.
+ */
+
+#define HOUR 3600
+#define DAY (24 * HOUR)
+
+/* version 1 records, from before there could be several DiskStations */
+struct tlog_rec_v1
+{
+	uint32_t time;
+	uint32_t span;
+	uint32_t dn;
+	uint32_t up;
+	char id[16];
+};
+
+struct bucket_ent
+{
+	uint32_t nas;
+	char id[16];
+	double dn;	/* bytes */
+	double up;
+	uint32_t covered;	/* seconds */
+};
+
+static int fd = -1;
+static char path[1024];
+static uint32_t compacted;
+
+static struct tlog_rec *batch;
+static int batch_len, batch_cap;
+static time_t batch_time, last_sample;
+static uint32_t batch_span;
+
+/* longest gap a single sample may stand for */
+static uint32_t span_max;
+
+static void
+human(double size, char *buf, int len)
+{
+	char u[] = "BkMGTPEZY";
+	int cur = 0;
+
+	while (size > 1024 && u[cur + 1])
+	{
+		cur += 1;
+		size /= 1024;
+	}
+
+	if (size < 10)
+		snprintf(buf, len, "%1.1f%c", size, u[cur]);
+	else
+		snprintf(buf, len, "%.0f%c", size, u[cur]);
+}
+
+static uint32_t
+bucket_length(uint32_t t, time_t now)
+{
+	time_t age = now - t;
+
+	if (age >= 30 * DAY)
+		return HOUR;
+	else if (age >= DAY)
+		return 300;
+	else
+		return 1;
+}
+
+/*
+	Compaction
+*/
+
+static int
+bucket_flush(FILE *out, uint32_t start, uint32_t len, struct bucket_ent *b,
+								int n)
+{
+	struct tlog_rec rec;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.id, b[i].id, sizeof(rec.id));
+		rec.nas = b[i].nas;
+		rec.time = start;
+		rec.span = b[i].covered < len ? b[i].covered : len;
+
+		/* the bytes stay what they were, whatever span they get */
+		rec.dn = b[i].dn / rec.span;
+		rec.up = b[i].up / rec.span;
+
+		if (fwrite(&rec, sizeof(rec), 1, out) != 1)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+compact_into(FILE *out, const struct tlog_rec *recs, int n, time_t now)
+{
+	static struct bucket_ent *b;
+	static int b_cap;
+	struct bucket_ent *tmp;
+	uint32_t len, start, cur, cur_len;
+	int i, k, b_len;
+
+	b_len = 0;
+	cur = 0;
+	cur_len = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		len = bucket_length(recs[i].time, now);
+		start = recs[i].time - recs[i].time % len;
+
+		if (len != cur_len || start != cur || len == 1)
+		{
+			if (bucket_flush(out, cur, cur_len, b, b_len) != 0)
+			{
+				return 1;
+			}
+
+			b_len = 0;
+			cur = start;
+			cur_len = len;
+		}
+
+		if (len == 1)
+		{
+			if (fwrite(&recs[i], sizeof(struct tlog_rec), 1, out) != 1)
+			{
+				return 1;
+			}
+
+			continue;
+		}
+
+		for (k = 0; k < b_len; k++)
+		{
+			if (b[k].nas == recs[i].nas &&
+				!strncmp(b[k].id, recs[i].id, sizeof(b[k].id)))
+			{
+				break;
+			}
+		}
+
+		if (k == b_len)
+		{
+			if (b_len == b_cap)
+			{
+				b_cap = b_cap ? b_cap * 2 : 64;
+				tmp = realloc(b, b_cap * sizeof(struct bucket_ent));
+
+				if (!tmp)
+				{
+					fprintf(stderr, "Realloc failed\n");
+					return 1;
+				}
+
+				b = tmp;
+			}
+
+			memset(&b[k], 0, sizeof(struct bucket_ent));
+			memcpy(b[k].id, recs[i].id, sizeof(b[k].id));
+			b[k].nas = recs[i].nas;
+			b_len += 1;
+		}
+
+		b[k].dn += (double) recs[i].dn * recs[i].span;
+		b[k].up += (double) recs[i].up * recs[i].span;
+		b[k].covered += recs[i].span;
+	}
+
+	return bucket_flush(out, cur, cur_len, b, b_len);
+}
+
+/* rewrites the log with old records merged, then swaps it in */
+static int
+compact()
+{
+	struct tlog_header hdr;
+	struct stat st;
+	char tmp_fn[1040];
+	void *map;
+	FILE *out;
+	time_t now;
+	int res, n;
+
+	if (fstat(fd, &st) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	n = (st.st_size - sizeof(hdr)) / sizeof(struct tlog_rec);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED)
+	{
+		perror(path);
+		return 1;
+	}
+
+	snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", path);
+
+	if (!(out = fopen(tmp_fn, "w")))
+	{
+		perror(tmp_fn);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	now = time(NULL);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TLOG_MAGIC, sizeof(hdr.magic));
+	hdr.version = TLOG_VERSION;
+	hdr.compacted = now - DAY;
+
+	res = fwrite(&hdr, sizeof(hdr), 1, out) != 1;
+	res = res || compact_into(out, (struct tlog_rec *)
+				((char *) map + sizeof(hdr)), n, now);
+	res = (fclose(out) != 0) || res;
+
+	munmap(map, st.st_size);
+
+	if (res || rename(tmp_fn, path) != 0)
+	{
+		perror(tmp_fn);
+		unlink(tmp_fn);
+		return 1;
+	}
+
+	close(fd);
+	compacted = hdr.compacted;
+
+	if ((fd = open(path, O_RDWR | O_APPEND)) < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* rewrites a version 1 log in the current format, all on the first NAS */
+static int
+upgrade(const char *fn)
+{
+	struct tlog_header hdr;
+	struct tlog_rec_v1 old;
+	struct tlog_rec rec;
+	char tmp_fn[1040];
+	FILE *in, *out;
+	int res;
+
+	if (!(in = fopen(fn, "r")))
+	{
+		perror(fn);
+		return 1;
+	}
+
+	snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+	if (!(out = fopen(tmp_fn, "w")))
+	{
+		perror(tmp_fn);
+		fclose(in);
+		return 1;
+	}
+
+	res = fread(&hdr, sizeof(hdr), 1, in) != 1;
+	hdr.version = TLOG_VERSION;
+	res = res || fwrite(&hdr, sizeof(hdr), 1, out) != 1;
+
+	while (!res && fread(&old, sizeof(old), 1, in) == 1)
+	{
+		memset(&rec, 0, sizeof(rec));
+		rec.time = old.time;
+		rec.span = old.span;
+		rec.dn = old.dn;
+		rec.up = old.up;
+		memcpy(rec.id, old.id, sizeof(rec.id));
+		res = fwrite(&rec, sizeof(rec), 1, out) != 1;
+	}
+
+	res = ferror(in) || res;
+	fclose(in);
+	res = (fclose(out) != 0) || res;
+
+	if (res || rename(tmp_fn, fn) != 0)
+	{
+		perror(tmp_fn);
+		unlink(tmp_fn);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+compact_due()
+{
+	return time(NULL) - DAY > (time_t) compacted + HOUR;
+}
+
+/*
+	Writing
+*/
+
+/*
+ * Samples further apart than span seconds are taken to mean that nobody
+ * was watching in between.
+ */
+int
+tlog_open(const char *fn, int span)
+{
+	struct tlog_header hdr;
+	struct stat st;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "%s", fn);
+
+	if ((fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644)) < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	len = read(fd, &hdr, sizeof(hdr));
+
+	if (len == 0)
+	{
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, TLOG_MAGIC, sizeof(hdr.magic));
+		hdr.version = TLOG_VERSION;
+		hdr.compacted = time(NULL) - DAY;
+
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		{
+			perror(path);
+			tlog_close();
+			return 1;
+		}
+	}
+	else if (len == sizeof(hdr) && !memcmp(hdr.magic, TLOG_MAGIC, 4) &&
+								hdr.version == 1)
+	{
+		close(fd);
+		fd = -1;
+
+		if (upgrade(path) != 0)
+		{
+			return 1;
+		}
+
+		return tlog_open(fn, span);
+	}
+	else if (len != sizeof(hdr) || memcmp(hdr.magic, TLOG_MAGIC, 4) ||
+					hdr.version != TLOG_VERSION)
+	{
+		fprintf(stderr, "%s: Not a synodl history file\n", path);
+		tlog_close();
+		return 1;
+	}
+
+	/* drop what an interrupted write left behind */
+	if (fstat(fd, &st) == 0 && (st.st_size - sizeof(hdr)) %
+					sizeof(struct tlog_rec) != 0)
+	{
+		if (ftruncate(fd, st.st_size - (st.st_size - sizeof(hdr)) %
+					sizeof(struct tlog_rec)) != 0)
+		{
+			perror(path);
+		}
+	}
+
+	compacted = hdr.compacted;
+	last_sample = 0;
+	span_max = span > 1 ? span : 1;
+
+	if (compact_due() && compact() != 0)
+	{
+		tlog_close();
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+tlog_close()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+
+	free(batch);
+
+	fd = -1;
+	batch = NULL;
+	batch_len = 0;
+	batch_cap = 0;
+}
+
+/* starts the samples of one refresh; returns 0 if there is no log */
+int
+tlog_begin()
+{
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	batch_time = time(NULL);
+	batch_span = last_sample ? batch_time - last_sample : 1;
+
+	if (batch_span < 1)
+		batch_span = 1;
+	else if (batch_span > span_max)
+		batch_span = span_max;
+
+	last_sample = batch_time;
+	batch_len = 0;
+	return 1;
+}
+
+void
+tlog_add(int nas, const char *id, int dn, int up)
+{
+	struct tlog_rec *tmp, *rec;
+
+	if (fd < 0)
+	{
+		return;
+	}
+
+	if (batch_len == batch_cap)
+	{
+		batch_cap = batch_cap ? batch_cap * 2 : 64;
+		tmp = realloc(batch, batch_cap * sizeof(struct tlog_rec));
+
+		if (!tmp)
+		{
+			fprintf(stderr, "Realloc failed\n");
+			return;
+		}
+
+		batch = tmp;
+	}
+
+	rec = &batch[batch_len++];
+	memset(rec, 0, sizeof(struct tlog_rec));
+	memcpy(rec->id, id, strnlen(id, sizeof(rec->id)));
+	rec->nas = nas;
+	rec->time = batch_time;
+	rec->span = batch_span;
+	rec->dn = dn > 0 ? dn : 0;
+	rec->up = up > 0 ? up : 0;
+}
+
+/* appends the samples in one go */
+int
+tlog_end()
+{
+	ssize_t len;
+
+	if (fd < 0 || batch_len == 0)
+	{
+		return 0;
+	}
+
+	len = batch_len * sizeof(struct tlog_rec);
+
+	if (write(fd, batch, len) != len)
+	{
+		perror(path);
+		return 1;
+	}
+
+	if (compact_due())
+	{
+		return compact();
+	}
+
+	return 0;
+}
+
+/*
+	Queries
+*/
+
+struct task_total
+{
+	uint32_t nas;
+	char id[16];
+	double dn;
+	double up;
+};
+
+static struct task_total *totals;
+static int totals_size, totals_used;
+
+static unsigned int
+id_hash(uint32_t nas, const char *id)
+{
+	unsigned int h = 2166136261u ^ nas;
+	int i;
+
+	for (i = 0; i < 16 && id[i]; i++)
+	{
+		h ^= (unsigned char) id[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static struct task_total *
+totals_get(uint32_t nas, const char *id)
+{
+	struct task_total *old, *t;
+	int i, old_size;
+	unsigned int h;
+
+	if (totals_used >= totals_size / 2)
+	{
+		old = totals;
+		old_size = totals_size;
+
+		totals_size = totals_size ? totals_size * 2 : 256;
+		totals = calloc(totals_size, sizeof(struct task_total));
+
+		if (!totals)
+		{
+			totals = old;
+			totals_size = old_size;
+			return NULL;
+		}
+
+		totals_used = 0;
+
+		for (i = 0; i < old_size; i++)
+		{
+			if (old[i].id[0] &&
+				(t = totals_get(old[i].nas, old[i].id)))
+			{
+				t->dn = old[i].dn;
+				t->up = old[i].up;
+			}
+		}
+
+		free(old);
+	}
+
+	for (h = id_hash(nas, id); ; h++)
+	{
+		t = &totals[h & (totals_size - 1)];
+
+		if (!t->id[0])
+		{
+			memcpy(t->id, id, sizeof(t->id));
+			t->nas = nas;
+			totals_used += 1;
+			return t;
+		}
+
+		if (t->nas == nas && !strncmp(t->id, id, sizeof(t->id)))
+		{
+			return t;
+		}
+	}
+}
+
+static int
+cmp_total(const void *pa, const void *pb)
+{
+	const struct task_total *a = pa, *b = pb;
+
+	return (a->dn < b->dn) - (a->dn > b->dn);
+}
+
+static void
+print_time(const char *label, time_t t)
+{
+	char buf[32];
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime(&t));
+	printf("%-14s%s\n", label, buf);
+}
+
+/* names is indexed by NAS, the column is left out for a single one */
+static void
+print_summary(time_t first, uint32_t covered, double dn, double up,
+		time_t best_hour, double best_dn, const char *const *names,
+								int count)
+{
+	char dn_buf[16], up_buf[16];
+	int i, n;
+
+	print_time("First sample", first);
+	if (covered < HOUR)
+		printf("%-14s%u minutes\n", "Sampled", covered / 60);
+	else
+		printf("%-14s%.1f hours\n", "Sampled", (double) covered / HOUR);
+
+	human(dn, dn_buf, sizeof(dn_buf));
+	human(up, up_buf, sizeof(up_buf));
+	printf("%-14s%s down, %s up\n", "Transferred", dn_buf, up_buf);
+
+	human(dn / covered, dn_buf, sizeof(dn_buf));
+	human(up / covered, up_buf, sizeof(up_buf));
+	printf("%-14s%s/s down, %s/s up\n", "Average", dn_buf, up_buf);
+
+	human(best_dn, dn_buf, sizeof(dn_buf));
+	human(best_dn / HOUR, up_buf, sizeof(up_buf));
+	print_time("Busiest hour", best_hour);
+	printf("%-14s%s down (%s/s)\n", "", dn_buf, up_buf);
+
+	if (totals_used == 0)
+	{
+		return;
+	}
+
+	/* squeeze the table, then rank it */
+	for (i = 0, n = 0; i < totals_size; i++)
+	{
+		if (totals[i].id[0])
+		{
+			totals[n++] = totals[i];
+		}
+	}
+
+	qsort(totals, n, sizeof(struct task_total), cmp_total);
+	printf("\nTop tasks:\n");
+
+	for (i = 0; i < n && i < 10; i++)
+	{
+		human(totals[i].dn, dn_buf, sizeof(dn_buf));
+		human(totals[i].up, up_buf, sizeof(up_buf));
+		printf("  ");
+
+		if (count > 1)
+		{
+			printf("%-16.16s ", totals[i].nas < (uint32_t) count ?
+						names[totals[i].nas] : "?");
+		}
+
+		printf("%-16.16s %8s down %8s up\n", totals[i].id, dn_buf,
+								up_buf);
+	}
+}
+
+/*
+ * Sums up everything the log has since the given time. names has the
+ * names of the count DiskStations the log may have tasks of.
+ */
+int
+tlog_query(const char *fn, time_t since, const char *const *names,
+								int count)
+{
+	struct tlog_header *hdr;
+	struct tlog_rec *recs;
+	struct task_total *t;
+	struct stat st;
+	double dn, up, hour_dn, best_dn;
+	uint32_t covered, first, hour, best_hour;
+	int qfd, lo, hi, mid, n, i;
+	void *map;
+
+	if ((qfd = open(fn, O_RDONLY)) < 0 || fstat(qfd, &st) != 0)
+	{
+		perror(fn);
+		return 1;
+	}
+
+	if (st.st_size < (off_t) sizeof(struct tlog_header))
+	{
+		fprintf(stderr, "%s: No history recorded yet\n", fn);
+		close(qfd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, qfd, 0);
+	close(qfd);
+
+	if (map == MAP_FAILED)
+	{
+		perror(fn);
+		return 1;
+	}
+
+	hdr = map;
+
+	/* written before there were several DiskStations */
+	if (!memcmp(hdr->magic, TLOG_MAGIC, 4) && hdr->version == 1)
+	{
+		munmap(map, st.st_size);
+		return upgrade(fn) || tlog_query(fn, since, names, count);
+	}
+
+	if (memcmp(hdr->magic, TLOG_MAGIC, 4) || hdr->version != TLOG_VERSION)
+	{
+		fprintf(stderr, "%s: Not a synodl history file\n", fn);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	recs = (struct tlog_rec *) ((char *) map + sizeof(struct tlog_header));
+	n = (st.st_size - sizeof(struct tlog_header)) / sizeof(struct tlog_rec);
+
+	/* only the pages from here on are ever touched */
+	lo = 0;
+	hi = n;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+
+		if (recs[mid].time < since)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	dn = 0;
+	up = 0;
+	covered = 0;
+	first = lo < n ? recs[lo].time : 0;
+	hour = 0;
+	hour_dn = 0;
+	best_hour = 0;
+	best_dn = -1;
+
+	for (i = lo; i < n; i++)
+	{
+		if (recs[i].id[0])
+		{
+			if ((t = totals_get(recs[i].nas, recs[i].id)))
+			{
+				t->dn += (double) recs[i].dn * recs[i].span;
+				t->up += (double) recs[i].up * recs[i].span;
+			}
+
+			continue;
+		}
+
+		dn += (double) recs[i].dn * recs[i].span;
+		up += (double) recs[i].up * recs[i].span;
+		covered += recs[i].span;
+
+		if (recs[i].time - recs[i].time % HOUR != hour)
+		{
+			hour = recs[i].time - recs[i].time % HOUR;
+			hour_dn = 0;
+		}
+
+		hour_dn += (double) recs[i].dn * recs[i].span;
+
+		if (hour_dn > best_dn)
+		{
+			best_dn = hour_dn;
+			best_hour = hour;
+		}
+	}
+
+	munmap(map, st.st_size);
+
+	if (covered == 0)
+	{
+		printf("No samples in that time\n");
+	}
+	else
+	{
+		print_summary(first, covered, dn, up, best_hour, best_dn,
+								names, count);
+	}
+
+	free(totals);
+	totals = NULL;
+	totals_size = 0;
+	totals_used = 0;
+	return 0;
+}
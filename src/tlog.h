@@ -0,0 +1,58 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNODL_TLOG_H
+#define __SYNODL_TLOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define TLOG_MAGIC "SDLT"
+#define TLOG_VERSION 2
+
+struct tlog_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t compacted;	/* records before this are downsampled */
+	uint32_t reserved;
+};
+
+/* average speeds over span seconds from time on; id is empty for totals */
+struct tlog_rec
+{
+	uint32_t time;
+	uint32_t span;
+	uint32_t dn;
+	uint32_t up;
+	uint32_t nas;	/* index in the configuration file */
+	char id[16];
+};
+
+int tlog_open(const char *fn, int span);
+void tlog_close();
+int tlog_begin();
+void tlog_add(int nas, const char *id, int dn, int up);
+int tlog_end();
+
+int tlog_query(const char *fn, time_t since, const char *const *names,
+								int count);
+
+#endif
@@ -18,6 +18,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
 #include <math.h>
 #include <ncurses.h>
 #include <signal.h>
@@ -29,28 +32,65 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/ioctl.h>
 
 #include "config.h"
+#include "bt.h"
+#include "cfg.h"
+#include "cleanup.h"
+#include "cmd.h"
+#include "details.h"
+#include "history.h"
+#include "hooks.h"
+#include "nas.h"
+#include "poller.h"
+#include "queue.h"
+#include "schedule.h"
+#include "search.h"
+#include "stall.h"
 #include "syno.h"
+#include "tasks.h"
+#include "tlog.h"
 #include "ui.h"
 
 /*
 	Common
 */
 
-struct tasklist_ent
-{
-	struct task *t;
-	struct tasklist_ent *next;
-	struct tasklist_ent *prev;
-};
-
-struct tasklist_ent *tasks;
 struct tasklist_ent *nc_selected_task;
 
+/* marked tasks, and where the last range of marks started */
+static int marked_count;
+static struct tasklist_ent *mark_anchor;
+
 /*
 	Curses UI
 */
 
 static WINDOW *status, *list, *version, *header;
+static int64_t refresh_wire, refresh_body;
+static int totals_up, totals_dn;
+static struct history totals_hist;
+
+/* per DiskStation; the NAS column only shows when there are several */
+static int nas_up[CFG_NAS_MAX], nas_dn[CFG_NAS_MAX];
+static int nas_col;
+
+/* the main thread's own requests go to the first DiskStation */
+static struct session *session;
+
+/* where error messages went before the screen was ours */
+static int saved_stderr = -1;
+
+/* the cleanup rules only show which tasks they would remove */
+static int dry_run;
+
+/* a message that survives the next few updates of the totals */
+static char notice[128];
+static time_t notice_until;
+
+/* when to fetch the list of each NAS next */
+static struct cfg *run_config;
+static struct poller pollers[CFG_NAS_MAX];
+static double next_refresh[CFG_NAS_MAX];
+static int sched;	/* schedule window in force, -2 before the first */
 
 static void
 nc_status_color(const char *status, WINDOW *win)
@@ -128,8 +168,9 @@ unit(double size, char *buf, ssize_t len)
 static int
 nc_status(const char *fmt, ...)
 {
-	char buf[6];
+	char buf[6], text[512];
 	time_t now;
+	int i, cols;
 
 	now = time(NULL);
 	strftime(buf, sizeof(buf), "%H:%M", localtime(&now));
@@ -139,110 +180,340 @@ nc_status(const char *fmt, ...)
 
 	va_list args;
 	va_start(args, fmt);
-	mvwprintw(status, 0, 10, fmt, args);
+	vsnprintf(text, sizeof(text), fmt, args);
 	va_end(args);
 
+	/* cut off at the edge of the screen rather than wrap around */
+	for (i = 0, cols = 0; text[i] && (cols < COLS - 11 ||
+				(text[i] & 0xc0) == 0x80); i++)
+	{
+		if ((text[i] & 0xc0) != 0x80)
+		{
+			cols += 1;
+		}
+	}
+
+	mvwaddnstr(status, 0, 10, text, i);
+
 	wrefresh(status);
 	return 0;
 }
 
+/* " [name ↓ x/s, name offline]" if there is more than one DiskStation */
+static void
+nc_nas_totals(char *buf, int size)
+{
+	char dn_buf[32];
+	int i, len;
+
+	buf[0] = 0;
+
+	if (nas_count() < 2)
+	{
+		return;
+	}
+
+	for (i = 0, len = 0; i < nas_count() && len < size; i++)
+	{
+		switch (nas_state(i))
+		{
+		case NAS_CONNECTING:
+			snprintf(dn_buf, sizeof(dn_buf), "connecting");
+			break;
+		case NAS_OFFLINE:
+			snprintf(dn_buf, sizeof(dn_buf), "offline");
+			break;
+		default:
+			unit(nas_dn[i], dn_buf, sizeof(dn_buf));
+			strncat(dn_buf, "/s", sizeof(dn_buf) - strlen(dn_buf) - 1);
+			break;
+		}
+
+		len += snprintf(buf + len, size - len, "%s%s %s%s",
+			i ? ", " : " [", nas_name(i),
+			nas_state(i) == NAS_ONLINE ? "↓ " : "", dn_buf);
+	}
+
+	if (len < size)
+	{
+		snprintf(buf + len, size - len, "]");
+	}
+}
+
+/* a list that takes a while to come in, for the status bar */
+static int
+nc_activity(char *buf, int size)
+{
+	char bytes_buf[32];
+	int64_t bytes;
+	double elapsed;
+	int i;
+
+	for (i = 0; i < nas_count(); i++)
+	{
+		if (nas_progress(i, &bytes, &elapsed) && elapsed >= 0.5)
+		{
+			unit(bytes, bytes_buf, sizeof(bytes_buf));
+			snprintf(buf, size, "Fetching %s: %s in %.1fs, 'c' "
+				"cancels.", nas_name(i), bytes_buf, elapsed);
+			return 1;
+		}
+	}
+
+	if ((i = cmd_uploads()) > 0)
+	{
+		snprintf(buf, size, "Uploading %d file(s), 'c' cancels.", i);
+		return 1;
+	}
+
+	return 0;
+}
+
 static int
 nc_status_totals(int up, int dn)
 {
-	char up_buf[32], dn_buf[32];
-	char speed[128];
+	char up_buf[32], dn_buf[32], wire_buf[32], body_buf[32], spark[64];
+	char boxes[256], activity[128], stalled[64], bytes_buf[32];
+	struct stall_stats st;
 
+	history_spark(&totals_hist, 16, spark, sizeof(spark));
 	unit(up, up_buf, sizeof(up_buf));
 	unit(dn, dn_buf, sizeof(dn_buf));
-	snprintf(speed, sizeof(speed), "↑ %s/s, ↓ %s/s.  Press '?' for help.",
-								up_buf, dn_buf);
-	return nc_status(speed);
+	unit(refresh_wire, wire_buf, sizeof(wire_buf));
+	unit(refresh_body, body_buf, sizeof(body_buf));
+	nc_nas_totals(boxes, sizeof(boxes));
+
+	/* what restarting stalled tasks has brought so far */
+	stall_stats(&st);
+	stalled[0] = 0;
+
+	if (st.restarted > 0)
+	{
+		unit(st.reclaimed, bytes_buf, sizeof(bytes_buf));
+		snprintf(stalled, sizeof(stalled), ", %d restarted, %s "
+				"reclaimed", st.restarted, bytes_buf);
+	}
+
+	if (time(NULL) < notice_until)
+		snprintf(activity, sizeof(activity), "%s", notice);
+	else if (!nc_activity(activity, sizeof(activity)))
+		snprintf(activity, sizeof(activity), "Press '?' for help.");
+
+	return nc_status("↑ %s/s, ↓ %s/s %s%s, refresh %s (%s)%s.  %s", up_buf,
+		dn_buf, spark, boxes, wire_buf, body_buf, stalled, activity);
+}
+
+static void
+nc_notice(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(notice, sizeof(notice), fmt, args);
+	va_end(args);
+
+	notice_until = time(NULL) + 10;
+	nc_status_totals(totals_up, totals_dn);
 }
 
+/* rows of the task list on screen */
 static int
-selected_position()
+nc_rows()
 {
-	int pos = 0;
-	struct tasklist_ent *tmp;
+	return LINES - 2;
+}
 
-	for (tmp = tasks; tmp != NULL; tmp = tmp->next)
+/* width of the task name column */
+static int
+nc_name_width()
+{
+	return COLS - 29 - nas_col;
+}
+
+/* screen columns taken by the first n bytes of a UTF-8 string */
+static int
+nc_columns(const char *s, int n)
+{
+	int i, cols;
+
+	for (i = 0, cols = 0; i < n && s[i]; i++)
 	{
-		if (tmp == nc_selected_task)
+		if ((s[i] & 0xc0) != 0x80)
 		{
-			return pos;
+			cols += 1;
 		}
-
-		pos += 1;
 	}
 
-	return pos;
+	return cols;
 }
 
 static void
-nc_print_tasks()
+nc_print_task(int i, struct tasklist_ent *ent, int tn_width, const char *fmt)
 {
-	struct tasklist_ent *tmp;
 	struct task *t;
-	int i, tn_width, total_dn, total_up, pos, pagenum;
-	char fmt[16];
+	const char *status;
 	char buf[32];
+	int off, len, col, width, x;
+	double left;
 
-	i = 0;
-	total_dn = 0;
-	total_up = 0;
-	pos = selected_position();
+	t = ent->t;
 
-	tn_width = COLS - 24;
-	snprintf(fmt, sizeof(fmt), "%%-%d.%ds", tn_width, tn_width);
+	wmove(list, i, 0);
+	wclrtoeol(list);
 
-	for (tmp = tasks; tmp != NULL; tmp = tmp->next)
+	if (ent == nc_selected_task)
 	{
-		t = tmp->t;
+		wattron(list, A_BOLD);
+		mvwprintw(list, i, 0, ">");
+		mvwprintw(list, i, COLS - 1, "<");
+	}
+	else if (ent->marked)
+	{
+		mvwprintw(list, i, 0, "*");
+	}
+
+	/* file name */
+	if (ent->marked)
+	{
+		wattron(list, A_REVERSE);
+	}
 
-		total_dn += t->speed_dn;
-		total_up += t->speed_up;
+	mvwprintw(list, i, 1, fmt, t->fn);
+	wattroff(list, A_REVERSE);
+
+	/* the part of the name that matches the search */
+	if ((off = search_hit(ent, &len)) >= 0)
+	{
+		col = nc_columns(ent->fold, off);
+		width = nc_columns(ent->fold + off, len);
 
-		wmove(list, i, 0);
-		wclrtoeol(list);
+		if (col + width > tn_width)
+		{
+			width = tn_width - col;
+		}
 
-		if (tmp == nc_selected_task)
+		if (width > 0)
 		{
-			wattron(list, A_BOLD);
-			mvwprintw(list, i, 0, ">");
-			mvwprintw(list, i, COLS - 1, "<");
+			mvwchgat(list, i, 1 + col, width, A_BOLD | A_UNDERLINE |
+				(ent->marked ? A_REVERSE : 0), 0, NULL);
 		}
+	}
+
+	/* DiskStation */
+	if (nas_col)
+	{
+		mvwprintw(list, i, tn_width + 2, "%-8.8s", nas_name(ent->nas));
+	}
+
+	x = tn_width + nas_col;
+
+	/* size */
+	unit(t->size, buf, sizeof(buf));
+	mvwprintw(list, i, x + 2, "%-5s", buf);
+
+	/* status, stalled and expired ones in red */
+	status = ent->stalled ? "stalled" : ent->expired ? "expired" :
+								t->status;
+	nc_status_color(status, list);
+	mvwprintw(list, i, x + 7, "%-11s", ent->queued ? "queued" : status);
+	nc_status_color_off(status, list);
+
+	/* percent */
+	mvwprintw(list, i, x + 19, "%3d%%", t->percent_dn);
 
-		/* file name */
-		mvwprintw(list, i, 1, fmt, t->fn);
+	/* time left */
+	left = history_eta(&ent->hist, t->size - t->downloaded);
+	history_format_eta(left, buf, sizeof(buf));
+	mvwprintw(list, i, x + 24, "%4s", left == 0 ? "" : buf);
 
-		/* size */
-		unit(t->size, buf, sizeof(buf));
-		mvwprintw(list, i, tn_width + 2, "%-5s", buf);
+	wattroff(list, COLOR_PAIR(2));
+	wattroff(list, A_BOLD);
 
-		/* status */
-		nc_status_color(t->status, list);
-		mvwprintw(list, i, tn_width + 7, "%-11s", t->status);
-		nc_status_color_off(t->status, list);
+	mvwhline(list, i, tn_width + 1, ACS_VLINE, 1);
+	mvwhline(list, i, x + 1, ACS_VLINE, 1);
+	mvwhline(list, i, x + 6, ACS_VLINE, 1);
+	mvwhline(list, i, x + 18, ACS_VLINE, 1);
+	mvwhline(list, i, x + 23, ACS_VLINE, 1);
+
+	ent->dirty = 0;
+}
+
+/* all == 0 only repaints the rows a refresh has changed */
+static void
+nc_redraw(int all)
+{
+	struct tasklist_ent *tmp;
+	int i, tn_width, total_dn, total_up, first, last;
+	char fmt[16];
 
-		/* percent */
-		mvwprintw(list, i, tn_width + 19, "%3d%%", t->percent_dn);
+	if (view_update())
+	{
+		all = 1;
+	}
 
-		wattroff(list, COLOR_PAIR(2));
-		wattroff(list, A_BOLD);
+	/* the selection might have been filtered out or deleted */
+	if (!nc_selected_task || nc_selected_task->pos < 0)
+	{
+		nc_selected_task = view.len ? view.ents[0] : NULL;
+		all = 1;
+	}
 
-		mvwhline(list, i, tn_width + 1, ACS_VLINE, 1);
-		mvwhline(list, i, tn_width + 6, ACS_VLINE, 1);
-		mvwhline(list, i, tn_width + 18, ACS_VLINE, 1);
+	memset(nas_dn, 0, sizeof(nas_dn));
+	memset(nas_up, 0, sizeof(nas_up));
 
-		i++;
+	for (tmp = tasks; tmp != NULL; tmp = tmp->next)
+	{
+		nas_dn[tmp->nas] += tmp->t->speed_dn;
+		nas_up[tmp->nas] += tmp->t->speed_up;
 	}
 
-	wmove(list, i, 0);
-	wclrtobot(list);
+	total_dn = 0;
+	total_up = 0;
+
+	for (i = 0; i < nas_count(); i++)
+	{
+		total_dn += nas_dn[i];
+		total_up += nas_up[i];
+	}
+
+	tn_width = nc_name_width();
+	snprintf(fmt, sizeof(fmt), "%%-%d.%ds", tn_width, tn_width);
+
+	/* only the page with the selection is ever drawn */
+	first = nc_selected_task ? nc_selected_task->pos : 0;
+	first -= first % nc_rows();
+	last = first + nc_rows();
+
+	if (last > view.len)
+	{
+		last = view.len;
+	}
+
+	for (i = first; i < last; i++)
+	{
+		if (all || view.ents[i]->dirty)
+		{
+			nc_print_task(i - first, view.ents[i], tn_width, fmt);
+		}
+	}
+
+	if (all)
+	{
+		wmove(list, last - first, 0);
+		wclrtobot(list);
+	}
+
+	totals_up = total_up;
+	totals_dn = total_dn;
 	nc_status_totals(total_up, total_dn);
 
-	pagenum = pos / (LINES - 2);
-	prefresh(list, pagenum * (LINES - 2), 0, 1, 0, LINES - 2, COLS);
+	prefresh(list, 0, 0, 1, 0, LINES - 2, COLS);
+}
+
+static void
+nc_print_tasks()
+{
+	nc_redraw(1);
 }
 
 static void
@@ -283,94 +554,70 @@ nc_alert(const char *text)
 }
 
 static void
-nc_select_first()
+nc_select_pos(int pos)
 {
-	if (!nc_selected_task)
+	if (!nc_selected_task || view.len == 0)
 	{
 		return;
 	}
 
-	while (nc_selected_task->prev)
+	if (pos < 0)
+	{
+		pos = 0;
+	}
+	if (pos >= view.len)
 	{
-		nc_selected_task = nc_selected_task->prev;
+		pos = view.len - 1;
 	}
+
+	nc_selected_task = view.ents[pos];
 }
 
 static void
-nc_select_last()
+nc_select_first()
 {
-	if (!nc_selected_task)
-	{
-		return;
-	}
+	nc_select_pos(0);
+}
 
-	while (nc_selected_task->next)
-	{
-		nc_selected_task = nc_selected_task->next;
-	}
+static void
+nc_select_last()
+{
+	nc_select_pos(view.len - 1);
 }
 
 static void
 nc_select_prev()
 {
-	if (!nc_selected_task)
-	{
-		return;
-	}
-
-	if (nc_selected_task->prev)
+	if (nc_selected_task)
 	{
-		nc_selected_task = nc_selected_task->prev;
+		nc_select_pos(nc_selected_task->pos - 1);
 	}
 }
 
 static void
 nc_select_next()
 {
-	if (!nc_selected_task)
-	{
-		return;
-	}
-
-	if (nc_selected_task->next)
+	if (nc_selected_task)
 	{
-		nc_selected_task = nc_selected_task->next;
+		nc_select_pos(nc_selected_task->pos + 1);
 	}
 }
 
 static void
 nc_select_prev_page()
 {
-	int skipped;
-
-	if (!nc_selected_task)
-	{
-		return;
-	}
-
-	skipped = 0;
-
-	while (nc_selected_task->prev && (skipped++ < (LINES - 2)))
+	if (nc_selected_task)
 	{
-		nc_selected_task = nc_selected_task->prev;
+		nc_select_pos(nc_selected_task->pos - nc_rows());
 	}
 }
 
 static void
 nc_select_next_page()
 {
-	int skipped;
-
-	if (!nc_selected_task)
+	if (nc_selected_task)
 	{
-		return;
-	}
-
-	skipped = 0;
-
-	while (nc_selected_task->next && (skipped++ < (LINES - 2)))
-	{
-		nc_selected_task = nc_selected_task->next;
+		nc_select_pos(nc_selected_task->pos + nc_rows());
 	}
 }
 
@@ -393,27 +640,56 @@ nc_status_bar()
 static void
 nc_header()
 {
-	char fmt[16];
-	int tn_width;
+	char fmt[16], title[128];
+	int tn_width, len, x;
 
 	if (header)
 	{
 		delwin(header);
 	}
 
-	tn_width = COLS - 24;
+	tn_width = nc_name_width();
+	x = tn_width + nas_col;
 	snprintf(fmt, sizeof(fmt), "%%-%d.%ds", tn_width, tn_width);
 
 	header = newwin(1, COLS, 0, 0);
 
 	wattron(header, COLOR_PAIR(10));
 	mvwprintw(header, 0, 0, " ");
-	mvwprintw(header, 0, 1, fmt, "Download task");
-	mvwprintw(header, 0, tn_width + 2, "Size");
-	mvwprintw(header, 0, tn_width + 7, "%-11.11s Prog ", "Status");
+	len = snprintf(title, sizeof(title), "Download task (%s%s",
+		sort_names[view.key], view.reverse ? ", reversed" : "");
+
+	if (view.filter != FILTER_ALL && len < sizeof(title))
+	{
+		len += snprintf(title + len, sizeof(title) - len, ", %s",
+			filter_names[view.filter]);
+	}
+
+	if (view.text[0] && len < sizeof(title))
+	{
+		len += snprintf(title + len, sizeof(title) - len, ", \"%s\"",
+			view.text);
+	}
+
+	if (len < sizeof(title))
+	{
+		snprintf(title + len, sizeof(title) - len, ")");
+	}
+
+	mvwprintw(header, 0, 1, fmt, title);
+
+	if (nas_col)
+	{
+		mvwprintw(header, 0, tn_width + 2, "%-8s", "NAS");
+	}
+
+	mvwprintw(header, 0, x + 2, "Size");
+	mvwprintw(header, 0, x + 7, "%-11.11s Prog  ETA ", "Status");
 	mvwhline(header, 0, tn_width + 1, ACS_VLINE, 1);
-	mvwhline(header, 0, tn_width + 6, ACS_VLINE, 1);
-	mvwhline(header, 0, tn_width + 18, ACS_VLINE, 1);
+	mvwhline(header, 0, x + 1, ACS_VLINE, 1);
+	mvwhline(header, 0, x + 6, ACS_VLINE, 1);
+	mvwhline(header, 0, x + 18, ACS_VLINE, 1);
+	mvwhline(header, 0, x + 23, ACS_VLINE, 1);
 	wattroff(header, COLOR_PAIR(10));
 
 	wrefresh(header);
@@ -422,17 +698,13 @@ nc_header()
 static void
 nc_task_window()
 {
-	int nentries;
-
 	if (list)
 	{
 		delwin(list);
 	}
 
-	nentries = 1024;
-
-	/* TODO: do not use a fixed number */
-	list = newpad(nentries, COLS);
+	/* holds one page, nc_redraw() never draws more than that */
+	list = newpad(nc_rows(), COLS);
 	wrefresh(list);
 }
 
@@ -456,7 +728,7 @@ nc_help()
 	int h, w;
 	WINDOW *win, *help;
 
-	h = 11;
+	h = 26;
 	w = 33;
 
 	win = newwin(h, w, ((LINES - h) / 2), ((COLS - w) / 2));
@@ -473,14 +745,70 @@ nc_help()
 	wattroff(help, A_BOLD);
 	wprintw(help, " ... Add download task\n");
 	wattron(help, A_BOLD);
+	wprintw(help, "B");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Search BitTorrent\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "C");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Cancel refresh\n");
+	wattron(help, A_BOLD);
 	wprintw(help, "D");
 	wattroff(help, A_BOLD);
-	wprintw(help, " ... Delete selected task\n");
+	wprintw(help, " ... Delete task(s)\n");
 	wattron(help, A_BOLD);
 	wprintw(help, "I");
 	wattroff(help, A_BOLD);
 	wprintw(help, " ... Show task details\n");
 	wattron(help, A_BOLD);
+	wprintw(help, "L");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Upload torrent/NZB file\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "P");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Pause/resume task(s)\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "+/-");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Queue first/last\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "Space");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Mark/unmark task\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "V");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Mark up to last mark\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "U");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Unmark all tasks\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "S");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Change sort order\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "O");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Reverse sort order\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "F");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Filter by status\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "T");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Filter by title\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "/");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Search titles\n");
+	wattron(help, A_BOLD);
+	wprintw(help, "N");
+	wattroff(help, A_BOLD);
+	wprintw(help, " ... Next/previous match\n");
+	wattron(help, A_BOLD);
 	wprintw(help, "Q");
 	wattroff(help, A_BOLD);
 	wprintw(help, " ... Quit\n");
@@ -505,186 +833,1597 @@ nc_help()
 }
 
 static void
-nc_task_details(const char *base, struct session *s)
+nc_detail_line(WINDOW *win, int y, const char *label, const char *fmt, ...)
 {
-	struct task *t;
-	double progress;
-
-	if (!nc_selected_task)
-	{
-		return;
-	}
+	va_list args;
 
-	t = nc_selected_task->t;
+	wattron(win, A_BOLD);
+	mvwprintw(win, y, 3, "%-10s", label);
+	wattroff(win, A_BOLD);
+	wprintw(win, " ... ");
 
-	int h, w;
-	WINDOW *win, *help;
+	va_start(args, fmt);
+	vw_printw(win, fmt, args);
+	va_end(args);
+}
 
-	h = 10;
-	w = 41;
+/* the rows of a file, peer or tracker sub-list, from off on */
+static void
+nc_detail_rows(WINDOW *win, int y, int rows, int w, struct task_info *info,
+							int tab, int off)
+{
+	struct task_file *f;
+	struct task_peer *p;
+	struct task_tracker *tr;
+	char buf[32], buf2[32];
+	int i, width;
 
-	win = newwin(h, w, ((LINES - h) / 2), ((COLS - w) / 2));
-	wattron(win, COLOR_PAIR(1));
-	wbkgd(win, COLOR_PAIR(1));
-	box(win, 0, 0);
-	mvwprintw(win, 0, (w - 22) / 2, "[ Download task details ]");
-	wattroff(win, COLOR_PAIR(2));
-	wrefresh(win);
+	width = w - 6 - 22;
 
-	help = derwin(win, h - 3, w - 6, 2, 3);
+	for (i = 0; i < rows; i++)
+	{
+		wmove(win, y + i, 3);
 
-	/* status */
-	wattron(help, A_BOLD);
-	wprintw(help, "Status    ");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %s\n", t->status);
+		if (tab == 0 && off + i < info->nfiles)
+		{
+			f = &info->files[off + i];
+			unit(f->size, buf, sizeof(buf));
+			wprintw(win, "%-*.*s %5s %3d%% %-8.8s", width, width,
+				f->name, buf, f->size ? (int) (f->downloaded *
+				100 / f->size) : 0, f->priority);
+		}
+		else if (tab == 1 && off + i < info->npeers)
+		{
+			p = &info->peers[off + i];
+			unit(p->speed_dn, buf, sizeof(buf));
+			unit(p->speed_up, buf2, sizeof(buf2));
+			wprintw(win, "%-*.*s %3d%% ↓%5s ↑%5s", width - 1,
+				width - 1, p->address, (int) (p->progress *
+				100), buf, buf2);
+		}
+		else if (tab == 2 && off + i < info->ntrackers)
+		{
+			tr = &info->trackers[off + i];
+			wprintw(win, "%-*.*s %-12.12s %3d/%-3d", width - 2,
+				width - 2, tr->url, tr->status, tr->seeds,
+				tr->peers);
+		}
+	}
+}
+
+static void
+nc_print_details(WINDOW *win, struct tasklist_ent *ent, int tab, int *off)
+{
+	static const char *tabs[] = { "Files", "Peers", "Trackers" };
+	struct details *d;
+	struct task *t;
+	char buf[32], buf2[32], spark[HISTORY_SAMPLES * 4];
+	int h, w, y, i, rows, count[3];
+	time_t created;
+
+	getmaxyx(win, h, w);
+
+	werase(win);
+	box(win, 0, 0);
+	mvwprintw(win, 0, (w - 25) / 2, "[ Download task details ]");
+
+	d = details_lock(ent->nas, ent->t->id);
+	t = d ? &d->info.t : ent->t;
+
+	mvwprintw(win, 1, 3, "%.*s", w - 6, t->fn);
+	nc_detail_line(win, 3, "Status", "%s", t->status);
+
+	unit(t->size, buf, sizeof(buf));
+	nc_detail_line(win, 4, "Size", "%s", buf);
+
+	unit(t->downloaded, buf, sizeof(buf));
+	unit(t->uploaded, buf2, sizeof(buf2));
+	nc_detail_line(win, 5, "Done", "%s down (%d%%), %s up", buf,
+						t->percent_dn, buf2);
+
+	unit(t->speed_dn, buf, sizeof(buf));
+	unit(t->speed_up, buf2, sizeof(buf2));
+	nc_detail_line(win, 6, "Speed", "%s/s down, %s/s up", buf, buf2);
+
+	/* time left, from the smoothed speed */
+	history_format_eta(history_eta(&ent->hist, t->size - t->downloaded),
+							buf, sizeof(buf));
+	history_spark(&ent->hist, HISTORY_SAMPLES, spark, sizeof(spark));
+	nc_detail_line(win, 7, "ETA", "%-5s %s", buf, spark);
+
+	if (!d)
+	{
+		mvwprintw(win, 9, 3, "Loading details...");
+		details_unlock();
+		wrefresh(win);
+		return;
+	}
+
+	created = d->info.created;
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime(&created));
+	nc_detail_line(win, 8, "Created", "%s", created ? buf : "-");
+	nc_detail_line(win, 9, "Saved to", "%.*s", w - 22,
+						d->info.destination);
+	nc_detail_line(win, 10, "Peers", "%d seeders, %d leechers of %d",
+		d->info.seeders, d->info.leechers, d->info.total_peers);
+
+	if (d->res != 0)
+	{
+		mvwprintw(win, 1, w - 17, "(update failed)");
+	}
+
+	/* tabs over the sub-list */
+	count[0] = d->info.nfiles;
+	count[1] = d->info.npeers;
+	count[2] = d->info.ntrackers;
+
+	wmove(win, 12, 3);
+
+	for (i = 0; i < 3; i++)
+	{
+		if (i == tab)
+		{
+			wattron(win, A_REVERSE);
+		}
+
+		wprintw(win, " %s (%d) ", tabs[i], count[i]);
+		wattroff(win, A_REVERSE);
+		wprintw(win, " ");
+	}
+
+	/* only the rows on screen are ever drawn */
+	y = 13;
+	rows = h - y - 1;
+
+	if (*off > count[tab] - rows)
+	{
+		*off = count[tab] - rows;
+	}
+
+	if (*off < 0)
+	{
+		*off = 0;
+	}
+
+	if (rows > 0)
+	{
+		nc_detail_rows(win, y, rows, w, &d->info, tab, *off);
+	}
+
+	if (count[tab] > rows && rows > 0)
+	{
+		mvwprintw(win, h - 1, w - 24, "[ %d-%d of %d ]", *off + 1,
+					*off + rows, count[tab]);
+	}
+
+	details_unlock();
+	wrefresh(win);
+}
+
+static int nc_background();
+
+/*
+ * Shows what getinfo knows about the selected task, fetched in the
+ * background and kept current while the window is open. Tab switches
+ * between files, peers and trackers, which scroll with the arrow keys.
+ * The list is kept current underneath; the window closes if the task
+ * goes away.
+ */
+static void
+nc_task_details()
+{
+	struct tasklist_ent *ent;
+	WINDOW *win;
+	int h, w, tab, off, done, wait;
+
+	if (!(ent = nc_selected_task))
+	{
+		return;
+	}
+
+	h = LINES - 4;
+	w = COLS - 8 < 100 ? COLS - 8 : 100;
+
+	win = newwin(h, w, 2, (COLS - w) / 2);
+	wattron(win, COLOR_PAIR(1));
+	wbkgd(win, COLOR_PAIR(1));
+	keypad(win, TRUE);
+
+	tab = 0;
+	off = 0;
+	done = 0;
+
+	while (!done)
+	{
+		wait = nc_background();
+
+		if (nc_selected_task != ent)
+		{
+			break;
+		}
+
+		details_want(ent->nas, ent->t->id, DETAILS_LIVE);
+		nc_print_details(win, ent, tab, &off);
+		wtimeout(win, wait < 250 ? wait : 250);
+
+		switch (wgetch(win))
+		{
+		case ERR:
+			break;
+		case KEY_UP:
+		case 0x6b: /* k */
+			off -= 1;
+			break;
+		case KEY_DOWN:
+		case 0x6a: /* j */
+			off += 1;
+			break;
+		case KEY_PPAGE:
+			off -= h - 14;
+			break;
+		case KEY_NPAGE:
+			off += h - 14;
+			break;
+		case KEY_HOME:
+			off = 0;
+			break;
+		case KEY_END:
+			off = INT_MAX / 2;
+			break;
+		case 0x09: /* tab */
+			tab = (tab + 1) % 3;
+			off = 0;
+			break;
+		default:
+			done = 1;
+			break;
+		}
+	}
+
+	delwin(win);
+
+	touchwin(list);
+	nc_print_tasks();
+}
+
+/* gets the rows around the cursor ready for the detail window */
+static void
+nc_prefetch()
+{
+	struct tasklist_ent *ent;
+	int pos;
+
+	if (!nc_selected_task)
+	{
+		return;
+	}
+
+	pos = nc_selected_task->pos;
+
+	if (pos > 0)
+	{
+		ent = view.ents[pos - 1];
+		details_want(ent->nas, ent->t->id, DETAILS_TTL);
+	}
+
+	if (pos >= 0 && pos + 1 < view.len)
+	{
+		ent = view.ents[pos + 1];
+		details_want(ent->nas, ent->t->id, DETAILS_TTL);
+	}
+
+	ent = nc_selected_task;
+	details_want(ent->nas, ent->t->id, DETAILS_TTL);
+}
+
+/*
+ * Lets go of a task that is about to be removed from the list, moving the
+ * selection arg points to off it.
+ */
+static void
+nc_forget(struct tasklist_ent *ent, void *arg)
+{
+	struct tasklist_ent **selected = arg;
+	int i;
+
+	/* move on to the closest row that is still there */
+	if (ent == *selected && ent->pos >= 0)
+	{
+		*selected = NULL;
+
+		for (i = ent->pos + 1; i < view.len && !*selected; i++)
+		{
+			if (view.ents[i])
+			{
+				*selected = view.ents[i];
+			}
+		}
+
+		for (i = ent->pos - 1; i >= 0 && !*selected; i--)
+		{
+			if (view.ents[i])
+			{
+				*selected = view.ents[i];
+			}
+		}
+	}
+
+	if (ent == mark_anchor)
+	{
+		mark_anchor = NULL;
+	}
+
+	marked_count -= ent->marked;
+}
+
+/* marks the filter hides are kept, but not acted upon */
+static int
+nc_marked(struct tasklist_ent *ent)
+{
+	return ent->marked && ent->pos >= 0;
+}
+
+static int
+nc_visible_marks()
+{
+	struct tasklist_ent *ent;
+	int n;
+
+	for (ent = tasks, n = 0; ent; ent = ent->next)
+	{
+		n += nc_marked(ent);
+	}
+
+	return n;
+}
+
+static void
+nc_delete_task()
+{
+	WINDOW *win, *yes, *no;
+	struct tasklist_ent *ent, *next;
+	char text[32];
+	int ok, key, w, x, marks;
+
+	if (!nc_selected_task)
+	{
+		return;
+	}
+
+	marks = nc_visible_marks();
+
+	if (marks > 0)
+	{
+		snprintf(text, sizeof(text), "Delete %d tasks?", marks);
+	}
+	else
+	{
+		snprintf(text, sizeof(text), "Delete this task?");
+	}
+
+	w = strlen(text) + 4 > 21 ? strlen(text) + 4 : 21;
+	x = (w - 21) / 2;
+
+	win = newwin(5, w, (LINES / 2) - 3, (COLS - w) / 2);
+	wattron(win, COLOR_PAIR(11));
+	wbkgd(win, COLOR_PAIR(11));
+	box(win, 0, 0);
+	mvwprintw(win, 0, x + 5, "[ Delete ]");
+	mvwprintw(win, 1, 2, "%s", text);
+	wattroff(win, COLOR_PAIR(2));
+	wrefresh(win);
+
+	no = derwin(win, 1, 6, 3, x + 3);
+	wprintw(no, "[ No ]");
+
+	yes = derwin(win, 1, 7, 3, x + 11);
+	wprintw(yes, "[ Yes ]");
+
+	touchwin(win);
+	wrefresh(no);
+	wrefresh(yes);
+
+	wbkgd(no, COLOR_PAIR(10));
+	keypad(win, TRUE);
+
+	ok = 0;
+
+	while ((key = wgetch(win)) != 10)
+	{
+		switch (key)
+		{
+		case 0x09: /* TAB */
+			ok = 1 - ok;
+			break;
+		case KEY_LEFT:
+		case 0x68: /* h */
+			ok = 0;
+			break;
+		case KEY_RIGHT:
+		case 0x6c: /* l */
+			ok = 1;
+			break;
+		case 0x59: /* Y */
+		case 0x79: /* y */
+			ok = 1;
+			break;
+		case 0x4e: /* N */
+		case 0x6e: /* n */
+			ok = 0;
+			break;
+		}
+
+		if (ok)
+		{
+			wbkgd(no, COLOR_PAIR(11));
+			wbkgd(yes, COLOR_PAIR(10));
+		}
+		else
+		{
+			wbkgd(no, COLOR_PAIR(10));
+			wbkgd(yes, COLOR_PAIR(11));
+		}
+		wrefresh(no);
+		wrefresh(yes);
+	}
+
+	delwin(no);
+	delwin(yes);
+	delwin(win);
+
+	/* rows go away now, the worker tells us if that was wrong */
+	if (ok && marks == 0)
+	{
+		ent = nc_selected_task;
+
+		if (cmd_submit(CMD_DELETE, ent->nas, ent->t, ent->queued) == 0)
+		{
+			nc_forget(ent, &nc_selected_task);
+			tasks_remove(ent);
+		}
+	}
+	else if (ok)
+	{
+		for (ent = tasks; ent; ent = next)
+		{
+			next = ent->next;
+
+			if (nc_marked(ent) &&
+				cmd_submit(CMD_DELETE, ent->nas, ent->t,
+							ent->queued) == 0)
+			{
+				nc_forget(ent, &nc_selected_task);
+				tasks_remove(ent);
+			}
+		}
+	}
+
+	touchwin(list);
+	nc_print_tasks();
+}
+
+static int
+nc_submit(struct tasklist_ent *ent, enum cmd_method method)
+{
+	struct task *t;
+
+	t = ent->t;
+
+	if (cmd_submit(method, ent->nas, t, ent->queued) != 0)
+	{
+		return 1;
+	}
+
+	/* what the user does the queue manager must not undo */
+	ent->queued = 0;
+	ent->cycling = 0;
+
+	snprintf(t->status, sizeof(t->status), "%s",
+			method == CMD_PAUSE ? "paused" : "waiting");
+	t->speed_dn = 0;
+	t->speed_up = 0;
+
+	/* whatever the next list says must win over our guess */
+	t->fp = 0;
+
+	ent->dirty = 1;
+	ent->moved = 1;
+	return 0;
+}
+
+/*
+ * Toggles the selected task, or, if tasks are marked, pauses all of them
+ * unless they are all paused already, in which case they are resumed.
+ * Marked tasks the filter hides are left as they are.
+ */
+static void
+nc_pause_task()
+{
+	struct tasklist_ent *ent;
+	enum cmd_method method;
+	int failed;
+
+	if (!nc_selected_task)
+	{
+		return;
+	}
+
+	failed = 0;
+
+	if (nc_visible_marks() == 0)
+	{
+		method = strcmp(nc_selected_task->t->status, "paused") ?
+							CMD_PAUSE : CMD_RESUME;
+		failed = nc_submit(nc_selected_task, method);
+	}
+	else
+	{
+		method = CMD_RESUME;
+
+		for (ent = tasks; ent; ent = ent->next)
+		{
+			if (nc_marked(ent) && strcmp(ent->t->status, "paused"))
+			{
+				method = CMD_PAUSE;
+				break;
+			}
+		}
+
+		for (ent = tasks; ent; ent = ent->next)
+		{
+			if (!nc_marked(ent) || (method == CMD_PAUSE) ==
+					!strcmp(ent->t->status, "paused"))
+			{
+				continue;
+			}
+
+			failed |= nc_submit(ent, method);
+		}
+	}
+
+	if (failed)
+	{
+		nc_notice("Failed to queue command");
+	}
+
+	nc_redraw(0);
+}
+
+/* where the queue manager puts the selected task when resuming/pausing */
+static void
+nc_queue_move(int front)
+{
+	if (!nc_selected_task)
+	{
+		return;
+	}
+
+	if (!queue_enabled())
+	{
+		nc_notice("The queue is off, see queue_active");
+		return;
+	}
+
+	if (front)
+		queue_to_front(nc_selected_task);
+	else
+		queue_to_back(nc_selected_task);
+
+	queue_save();
+	nc_notice("Moved %s to the %s of the queue", nc_selected_task->t->fn,
+						front ? "front" : "back");
+}
+
+static void
+nc_mark_task()
+{
+	if (!nc_selected_task)
+	{
+		return;
+	}
+
+	nc_selected_task->marked = !nc_selected_task->marked;
+	marked_count += nc_selected_task->marked ? 1 : -1;
+	mark_anchor = nc_selected_task;
+
+	nc_select_next();
+	nc_print_tasks();
+}
+
+/* marks everything between the last toggled task and the selection */
+static void
+nc_mark_range()
+{
+	struct tasklist_ent *ent;
+	int i, from, to;
+
+	if (!nc_selected_task || !mark_anchor || mark_anchor->pos < 0)
+	{
+		return;
+	}
+
+	from = mark_anchor->pos;
+	to = nc_selected_task->pos;
+
+	if (from > to)
+	{
+		from = to;
+		to = mark_anchor->pos;
+	}
+
+	for (i = from; i <= to; i++)
+	{
+		ent = view.ents[i];
+
+		if (!ent->marked)
+		{
+			ent->marked = 1;
+			marked_count += 1;
+		}
+	}
+
+	mark_anchor = nc_selected_task;
+	nc_print_tasks();
+}
+
+static void
+nc_unmark_all()
+{
+	struct tasklist_ent *ent;
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		ent->marked = 0;
+	}
+
+	marked_count = 0;
+	mark_anchor = NULL;
+	nc_print_tasks();
+}
+
+static void
+nc_view_changed()
+{
+	view.stale = 1;
+	nc_header();
+	nc_print_tasks();
+}
+
+static void
+nc_sort_next()
+{
+	view.key = (view.key + 1) % SORT_KEYS;
+	nc_view_changed();
+	nc_status("Sorting by %s", sort_names[view.key]);
+}
+
+static void
+nc_sort_reverse()
+{
+	view.reverse = !view.reverse;
+	nc_view_changed();
+}
+
+static void
+nc_filter_next()
+{
+	view.filter = (view.filter + 1) % FILTERS;
+	nc_view_changed();
+	nc_status("Showing %s tasks (%d)", filter_names[view.filter], view.len);
+}
+
+/* reads a line of text in a dialog, buf holds the initial text */
+static void
+nc_prompt(const char *title, const char *label, char *buf, int size)
+{
+	WINDOW *win, *prompt;
+	char str[1024];
+	int i, len;
+
+	win = newwin(4, COLS - 4, (LINES / 2) - 3, 2);
+	wattron(win, COLOR_PAIR(1));
+	wbkgd(win, COLOR_PAIR(1));
+	box(win, 0, 0);
+	mvwprintw(win, 0, 3, "[ %s ]", title);
+	mvwprintw(win, 1, 2, "%s", label);
+	wattroff(win, COLOR_PAIR(2));
+	wrefresh(win);
+
+	prompt = derwin(win, 1, COLS - 8, 2, 2);
+	wbkgd(prompt, COLOR_PAIR(9));
+
+	touchwin(win);
+	wrefresh(prompt);
+
+	len = strlen(buf);
+
+	for (i = 0; i < len; i++)
+	{
+		ungetch(buf[len - i - 1]);
+	}
+
+	echo();
+	curs_set(1);
+	keypad(prompt, TRUE);
+	wgetnstr(prompt, str, size < (int) sizeof(str) ? size - 1 :
+						(int) sizeof(str) - 1);
+	curs_set(0);
+	noecho();
+
+	delwin(prompt);
+	delwin(win);
+
+	/* wgetnstr() kept it short enough */
+	strcpy(buf, str);
+	touchwin(list);
+}
+
+static void
+nc_filter_text()
+{
+	nc_prompt("Filter tasks", "Show tasks containing (empty for all):",
+					view.text, sizeof(view.text));
+	nc_view_changed();
+}
+
+static const char *bt_sort_names[] = { "seeds", "size", "title", "arrival" };
+static struct bt_result *bt_sorting;
+static int bt_key;
+
+static int
+nc_bt_cmp(const void *pa, const void *pb)
+{
+	int ia = *(const int *) pa, ib = *(const int *) pb;
+	struct bt_result *a = &bt_sorting[ia], *b = &bt_sorting[ib];
+	int res;
+
+	switch (bt_key)
+	{
+	case 0:
+		res = (a->seeds < b->seeds) - (a->seeds > b->seeds);
+		break;
+	case 1:
+		res = (a->size < b->size) - (a->size > b->size);
+		break;
+	case 2:
+		res = strcasecmp(a->title, b->title);
+		break;
+	default:
+		res = 0;
+		break;
+	}
+
+	return res ? res : ia - ib;
+}
+
+/* draws the results around row, returns the URI of the one on it */
+static void
+nc_bt_print(WINDOW *win, struct bt_query *q, int *order, int row,
+							char *uri, int len)
+{
+	struct bt_result *r;
+	char buf[32];
+	int i, rows, first, width;
+
+	width = COLS - 31;
+	rows = LINES - 3;
+	first = row - row % rows;
+
+	werase(win);
+
+	wattron(win, COLOR_PAIR(10));
+	mvwhline(win, 0, 0, ' ', COLS);
+	mvwprintw(win, 0, 1, "%-*.*s %6s %5s %5s %-10s", width, width,
+			"Search result", "Size", "Seeds", "Peers", "Provider");
+	wattroff(win, COLOR_PAIR(10));
+
+	uri[0] = 0;
+
+	for (i = first; q && i < q->n && i < first + rows; i++)
+	{
+		r = &q->results[order[i]];
+		unit(r->size, buf, sizeof(buf));
+
+		if (i == row)
+		{
+			wattron(win, A_BOLD);
+			mvwprintw(win, i - first + 1, 0, ">");
+			snprintf(uri, len, "%s", r->uri);
+		}
+
+		mvwprintw(win, i - first + 1, 1, "%-*.*s %6s %5d %5d %-10.10s",
+				width, width, r->title, buf, r->seeds,
+				r->leechs, r->provider);
+		wattroff(win, A_BOLD);
+	}
+
+	wattron(win, A_REVERSE);
+	mvwhline(win, LINES - 2, 0, ' ', COLS);
+	mvwprintw(win, LINES - 2, 1, "'%s': %d results%s, by %s.  Enter: "
+		"add, S: sort, Q: back", q->keyword, q->n, q->failed ?
+		", search failed" : q->finished ? "" : ", searching...",
+		bt_sort_names[bt_key]);
+	wattroff(win, A_REVERSE);
+
+	wrefresh(win);
+}
+
+/*
+ * Lets the user give up on a request the main thread is waiting for. Other
+ * keys are left for whoever reads them next.
+ */
+static int
+nc_abort_key(void *arg, int64_t bytes, double elapsed)
+{
+	int key, delay;
+
+	delay = wgetdelay(status);
+	wtimeout(status, 0);
+	key = wgetch(status);
+	wtimeout(status, delay);
+
+	if (key == 'c' || key == 'C')
+	{
+		return 1;
+	}
+
+	if (key != ERR)
+	{
+		ungetch(key);
+	}
+
+	return 0;
+}
+
+/* the session of the main thread, ready for a request to NAS 0 */
+static int
+nc_session()
+{
+	if (nas_session(0, &session) != 0)
+	{
+		return 1;
+	}
+
+	syno_set_progress(session, nc_abort_key, NULL);
+	return 0;
+}
+
+/* adds a task on the first DiskStation, returns why that failed if it did */
+static const char *
+nc_download(const char *uri)
+{
+	/* it never goes back to connecting, so this does not block */
+	if (nas_state(0) == NAS_CONNECTING)
+	{
+		return "Still connecting to the NAS";
+	}
+
+	if (nc_session() != 0)
+	{
+		return "NAS is offline";
+	}
+
+	nc_status("Adding task, 'c' cancels...");
+
+	if (syno_download(nas_url(0), session, uri) != 0)
+	{
+		return syno_strerror(syno_error(session));
+	}
+
+	return NULL;
+}
+
+/*
+ * Adds local .torrent/.nzb files as tasks on the first DiskStation. The
+ * name may be a shell pattern, it is expanded with glob(3). The files are
+ * sent by the command worker, see nc_collect_commands() for the results.
+ */
+static void
+nc_upload()
+{
+	char pattern[1024];
+	glob_t gl;
+	size_t i;
+
+	pattern[0] = 0;
+	nc_prompt("Upload files", "Torrent or NZB file(s):", pattern,
+							sizeof(pattern));
+	nc_print_tasks();
+
+	if (!strcmp(pattern, ""))
+	{
+		return;
+	}
+
+	if (glob(pattern, GLOB_TILDE, NULL, &gl) != 0)
+	{
+		nc_notice("No such file: %s", pattern);
+		return;
+	}
+
+	for (i = 0; i < gl.gl_pathc; i++)
+	{
+		if (cmd_upload(0, gl.gl_pathv[i]) != 0)
+		{
+			nc_notice("Failed to upload %s", gl.gl_pathv[i]);
+			break;
+		}
+	}
+
+	nc_status_totals(totals_up, totals_dn);
+	globfree(&gl);
+}
+
+/*
+ * Searches for torrents through DownloadStation. Results are shown while
+ * they come in; Enter adds the selected one as a download task. The list
+ * is kept current underneath.
+ */
+static void
+nc_bt_search()
+{
+	char keyword[128], uri[1024];
+	const char *err;
+	struct bt_query *q;
+	WINDOW *win;
+	int *order, *tmp, cap, n, i, row, sel, done, wait;
+
+	keyword[0] = 0;
+	nc_prompt("Search BitTorrent", "Keywords:", keyword, sizeof(keyword));
+
+	if (!strcmp(keyword, ""))
+	{
+		nc_print_tasks();
+		return;
+	}
+
+	bt_search(keyword);
+
+	win = newwin(LINES - 1, COLS, 0, 0);
+	keypad(win, TRUE);
+
+	order = NULL;
+	cap = 0;
+	sel = -1;
+	row = 0;
+	done = 0;
+
+	while (!done)
+	{
+		wait = nc_background();
+
+		/* the list underneath has been drawn over us */
+		touchwin(win);
+
+		q = bt_lock();
+		n = q ? q->n : 0;
+
+		if (n > cap)
+		{
+			if (!(tmp = realloc(order, n * 2 * sizeof(int))))
+			{
+				bt_unlock();
+				break;
+			}
+
+			order = tmp;
+			cap = n * 2;
+		}
+
+		/* results keep coming in, keep the selection on its row */
+		for (i = 0; i < n; i++)
+		{
+			order[i] = i;
+		}
+
+		bt_sorting = q ? q->results : NULL;
+		qsort(order, n, sizeof(int), nc_bt_cmp);
+
+		for (i = 0; i < n && sel >= 0; i++)
+		{
+			if (order[i] == sel)
+			{
+				row = i;
+				break;
+			}
+		}
+
+		if (row >= n)
+		{
+			row = n ? n - 1 : 0;
+		}
+
+		if (q)
+		{
+			nc_bt_print(win, q, order, row, uri, sizeof(uri));
+		}
+
+		bt_unlock();
+		wtimeout(win, wait < 250 ? wait : 250);
+
+		switch (wgetch(win))
+		{
+		case ERR:
+			break;
+		case KEY_UP:
+		case 0x6b: /* k */
+			row -= row > 0;
+			break;
+		case KEY_DOWN:
+		case 0x6a: /* j */
+			row += row < n - 1;
+			break;
+		case KEY_PPAGE:
+			row = row > LINES - 3 ? row - (LINES - 3) : 0;
+			break;
+		case KEY_NPAGE:
+			row = row + LINES - 3 < n ? row + LINES - 3 : n - 1;
+			break;
+		case 0x73: /* s */
+		case 0x53: /* S */
+			bt_key = (bt_key + 1) % 4;
+			break;
+		case 0x0a: /* enter */
+		case 0x61: /* a */
+		case 0x41: /* A */
+			if (!strcmp(uri, ""))
+			{
+				break;
+			}
+
+			if ((err = nc_download(uri)))
+				nc_notice("Failed to add task: %s", err);
+			else
+				nc_notice("Download task added");
+			break;
+		case 27:
+		case 0x71: /* q */
+		case 0x51: /* Q */
+			done = 1;
+			break;
+		}
+
+		sel = (row >= 0 && row < n) ? order[row] : -1;
+	}
+
+	bt_idle();
+	free(order);
+	delwin(win);
+
+	nc_header();
+	touchwin(list);
+	nc_print_tasks();
+}
+
+/* shows the rows matching a search while it is being typed */
+static void
+nc_print_results(struct tasklist_ent **res, int n, int sel)
+{
+	int i, tn_width, first, last;
+	char fmt[16];
+
+	nc_selected_task = n ? res[sel] : NULL;
+
+	tn_width = nc_name_width();
+	snprintf(fmt, sizeof(fmt), "%%-%d.%ds", tn_width, tn_width);
+
+	first = sel - sel % nc_rows();
+	last = first + nc_rows();
+
+	if (last > n)
+	{
+		last = n;
+	}
+
+	for (i = first; i < last; i++)
+	{
+		nc_print_task(i - first, res[i], tn_width, fmt);
+	}
+
+	wmove(list, last - first, 0);
+	wclrtobot(list);
+
+	prefresh(list, 0, 0, 1, 0, LINES - 2, COLS);
+}
+
+/*
+ * Reads a search query on the status line. The list narrows down to the
+ * matching tasks with every key; Enter jumps to the chosen one and leaves
+ * the matches highlighted for n/N, Esc goes back to where we were.
+ */
+static void
+nc_search()
+{
+	struct tasklist_ent **res, *prev;
+	char q[64];
+	int key, len, n, sel, x, y;
+
+	prev = nc_selected_task;
+	search_clear();
+
+	res = NULL;
+	q[0] = 0;
+	len = 0;
+	n = 0;
+	sel = 0;
+
+	wtimeout(status, -1);
+	curs_set(1);
+
+	while (1)
+	{
+		nc_status("/%s", q);
+		getyx(status, y, x);
+
+		if (len > 0)
+		{
+			mvwprintw(status, 0, COLS - 16, "%6d matches", n);
+		}
+
+		wmove(status, y, x);
+		wrefresh(status);
+
+		key = wgetch(status);
+
+		if (key == 27)
+		{
+			search_clear();
+			nc_selected_task = prev;
+			break;
+		}
+		else if (key == '\n' || key == KEY_ENTER)
+		{
+			nc_selected_task = n ? res[sel] : prev;
+			break;
+		}
+		else if (key == KEY_UP || key == KEY_DOWN)
+		{
+			if (key == KEY_UP && sel > 0)
+				sel -= 1;
+			else if (key == KEY_DOWN && sel < n - 1)
+				sel += 1;
+			else
+				continue;
+
+			nc_print_results(res, n, sel);
+			continue;
+		}
+		else if (key == KEY_BACKSPACE || key == 127 || key == 8)
+		{
+			if (len == 0)
+			{
+				continue;
+			}
+
+			q[--len] = 0;
+		}
+		else if (key >= 0x20 && key < 0x100 && len < sizeof(q) - 1)
+		{
+			q[len++] = key;
+			q[len] = 0;
+		}
+		else
+		{
+			continue;
+		}
+
+		sel = 0;
+
+		if (len == 0)
+		{
+			search_clear();
+			n = 0;
+			nc_selected_task = prev;
+			nc_redraw(1);
+			continue;
+		}
+
+		n = search_run(q, &res);
+		nc_print_results(res, n, sel);
+	}
+
+	curs_set(0);
+	nc_print_tasks();
+}
+
+static void
+nc_search_next(int dir)
+{
+	struct tasklist_ent *ent;
+
+	if (!(ent = search_next(nc_selected_task, dir)))
+	{
+		nc_status("No matches");
+		return;
+	}
+
+	nc_selected_task = ent;
+	nc_print_tasks();
+}
+
+/* rolls back failed commands; returns 1 once the queue has drained */
+static int
+nc_collect_commands()
+{
+	static const char *names[] = { "pause", "resume", "delete" };
+	struct tasklist_ent *ent;
+	struct cmd *c;
+	int collected;
+
+	collected = 0;
+
+	while ((c = cmd_done()))
+	{
+		collected = 1;
+
+		if (c->method == CMD_UPLOAD)
+		{
+			if (c->res == 0)
+				nc_notice("Added %s", c->file);
+			else
+				nc_notice("Failed to upload %s: %s", c->file,
+						syno_strerror(c->error));
+
+			free(c);
+			continue;
+		}
+
+		if (c->res == 0)
+		{
+			free(c);
+			continue;
+		}
+
+		if (c->method == CMD_DELETE)
+		{
+			if (!tasks_find(c->nas, c->t.id))
+			{
+				tasks_add(c->nas, &c->t);
+			}
+
+			/* keeps the cleanup from trying again right away */
+			if ((ent = tasks_find(c->nas, c->t.id)))
+			{
+				ent->switched = time(NULL);
+				ent->queued = c->queued;
+			}
+		}
+		else if ((ent = tasks_find(c->nas, c->t.id)))
+		{
+			memcpy(ent->t, &c->t, sizeof(struct task));
+			ent->dirty = 1;
+			ent->moved = 1;
+
+			/* a failed resume leaves it to the queue manager again */
+			ent->queued = c->queued;
+		}
+
+		nc_redraw(0);
+		nc_notice("Failed to %s %s: %s", names[c->method], c->t.fn,
+						syno_strerror(c->error));
+		free(c);
+	}
+
+	return collected && cmd_pending() == 0;
+}
+
+/* appends the speeds of this refresh to the transfer log, if any */
+static void
+nc_log_sample()
+{
+	struct tasklist_ent *ent;
+
+	if (!tlog_begin())
+	{
+		return;
+	}
+
+	tlog_add(0, "", totals_dn, totals_up);
+
+	for (ent = tasks; ent; ent = ent->next)
+	{
+		if (ent->t->speed_dn > 0 || ent->t->speed_up > 0)
+		{
+			tlog_add(ent->nas, ent->t->id, ent->t->speed_dn,
+							ent->t->speed_up);
+		}
+	}
+
+	if (tlog_end() != 0)
+	{
+		nc_notice("Failed to write the transfer history");
+	}
+}
+
+/* takes a task the cleanup rules are done with out of the list */
+static void
+nc_cleanup_remove(struct tasklist_ent *ent)
+{
+	if (cmd_submit(CMD_DELETE, ent->nas, ent->t, ent->queued) == 0)
+	{
+		nc_forget(ent, &nc_selected_task);
+		tasks_remove(ent);
+	}
+}
+
+static void
+nc_cleanup(int i)
+{
+	static int last[CFG_NAS_MAX];
+	int n;
+
+	/* a list from before our deletes went through would bring them back */
+	if (cmd_pending())
+	{
+		return;
+	}
+
+	n = cleanup_run(i, nc_cleanup_remove);
+
+	if (n > 0 && dry_run && n != last[i])
+	{
+		nc_notice("%d finished task(s) on %s would be removed", n,
+								nas_name(i));
+	}
+	else if (n > 0 && !dry_run)
+	{
+		nc_notice("Removed %d finished task(s) from %s", n,
+								nas_name(i));
+	}
+
+	last[i] = n;
+}
+
+static void
+nc_event(enum event_type type, int nas, const struct task *old,
+						const struct task *cur)
+{
+	if (hooks_fire(type, nas_name(nas), old, cur) != 0)
+	{
+		nc_notice("Too many hooks waiting, %s hook for %s dropped",
+				event_names[type], cur ? cur->fn : old->fn);
+	}
+}
+
+static void
+nc_stall_notice(struct tasklist_ent *ent, const char *what)
+{
+	nc_notice("%s %s", ent->t->fn, what);
+}
+
+/*
+ * Takes in the list the thread of NAS i has fetched, if there is one. Returns
+ * what syno_list() made of it, or -1 if nothing came in.
+ */
+static int
+tasks_refresh(int i, struct syno_stats *stats)
+{
+	int res;
+
+	tasks_begin();
+
+	if ((res = nas_collect(i, tasks_update, &i, stats)) < 0)
+	{
+		return res;
+	}
 
-	/* size */
-	char buf[32];
-	snprintf(buf, sizeof(buf), "%ld", t->size);
-	unit(t->size, buf, sizeof(buf));
-	wattron(help, A_BOLD);
-	wprintw(help, "Size      ");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %s\n", buf);
+	if (res != 0 && res != SYNO_UNCHANGED)
+	{
+		nc_notice("Could not refresh %s: %s", nas_name(i),
+						syno_strerror(stats->error));
+		return res;
+	}
 
-	/* downloaded */
-	snprintf(buf, sizeof(buf), "%ld", t->downloaded);
-	unit(t->downloaded, buf, sizeof(buf));
-	progress = ((double) t->downloaded / t->size);
-	wattron(help, A_BOLD);
-	wprintw(help, "Downloaded");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %s (%0.2f)\n", buf, progress);
+	refresh_wire = stats->wire_bytes;
+	refresh_body = stats->body_bytes;
 
-	/* uploaded */
-	snprintf(buf, sizeof(buf), "%ld", t->uploaded);
-	unit(t->uploaded, buf, sizeof(buf));
-	progress = ((double) t->uploaded / t->size);
-	wattron(help, A_BOLD);
-	wprintw(help, "Uploaded  ");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %s (%0.2f)\n", buf, progress);
+	if (res == 0)
+	{
+		tasks_sweep(i, nc_forget, &nc_selected_task);
+	}
 
-	/* speed down */
-	wattron(help, A_BOLD);
-	wprintw(help, "Speed down");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %d\n", t->speed_dn);
+	/* what our own commands did shows up here as well */
+	if (res == 0 && hooks_enabled())
+	{
+		events_diff(i, nc_event);
+	}
 
-	/* speed down */
-	wattron(help, A_BOLD);
-	wprintw(help, "Speed up  ");
-	wattroff(help, A_BOLD);
-	wprintw(help, " ... %d\n", t->speed_up);
+	tasks_sample();
+	nc_cleanup(i);
 
-	touchwin(win);
-	wrefresh(help);
+	/* while commands are out the list might not show them yet */
+	if (!cmd_pending() && stall_run(i, nc_submit, nc_stall_notice) == 0)
+	{
+		queue_run(i, nc_submit);
+	}
 
-	wgetch(help);
+	queue_save();
 
-	delwin(help);
-	delwin(win);
+	nc_redraw(0);
 
-	touchwin(list);
-	nc_print_tasks();
+	history_push(&totals_hist, totals_dn);
+	nc_status_totals(totals_up, totals_dn);
+	nc_log_sample();
+	return res;
+}
+
+/* a speed that starts, stops or halves/doubles means the list moved */
+static int
+speed_changed(int old, int cur)
+{
+	if ((old == 0) != (cur == 0))
+	{
+		return 1;
+	}
+
+	return cur > old * 2 || cur < old / 2;
+}
+
+/*
+ * Picks up the cheap statistics calls the NAS threads make between list
+ * fetches. Keeps the totals current and returns 1 for a NAS whose speeds
+ * changed enough to warrant a full refresh.
+ */
+static int
+nc_heartbeat(int i)
+{
+	static int last_up[CFG_NAS_MAX], last_dn[CFG_NAS_MAX];
+	int up, dn, changed, k;
+
+	if (!nas_beat(i, &up, &dn))
+	{
+		return 0;
+	}
+
+	changed = speed_changed(last_up[i], up) ||
+					speed_changed(last_dn[i], dn);
+	last_up[i] = up;
+	last_dn[i] = dn;
+
+	nas_up[i] = up;
+	nas_dn[i] = dn;
+
+	totals_up = 0;
+	totals_dn = 0;
+
+	for (k = 0; k < nas_count(); k++)
+	{
+		totals_up += nas_up[k];
+		totals_dn += nas_dn[k];
+	}
+
+	history_push(&totals_hist, totals_dn);
+	nc_status_totals(totals_up, totals_dn);
+
+	return changed;
 }
 
+/*
+ * Switches to the settings of the schedule window that has begun, if one
+ * has, and reports limits the NAS threads failed to set.
+ */
 static void
-nc_delete_task(const char *base, struct session *s)
+nc_schedule(struct cfg *config, int *cur)
 {
-	WINDOW *win, *yes, *no;
-	char buf[16];
-	int ok, key;
+	struct schedule_window w;
+	int i, error;
 
-	if (!nc_selected_task)
+	if (config->schedule.n == 0)
 	{
 		return;
 	}
 
-	win = newwin(5, 21, (LINES / 2) - 3, (COLS / 2) - 10);
-	wattron(win, COLOR_PAIR(11));
-	wbkgd(win, COLOR_PAIR(11));
-	box(win, 0, 0);
-	mvwprintw(win, 0, 5, "[ Delete ]");
-	mvwprintw(win, 1, 2, "Delete this task?");
-	wattroff(win, COLOR_PAIR(2));
-	wrefresh(win);
+	for (i = 0; i < nas_count(); i++)
+	{
+		if (nas_limits_done(i, &error) && error)
+		{
+			nc_notice("Failed to set the speed limits of %s: %s",
+					nas_name(i), syno_strerror(error));
+		}
+	}
 
-	no = derwin(win, 1, 6, 3, 3);
-	wprintw(no, "[ No ]");
+	if ((i = schedule_find(&config->schedule, time(NULL))) == *cur)
+	{
+		return;
+	}
 
-	yes = derwin(win, 1, 7, 3, 11);
-	wprintw(yes, "[ Yes ]");
+	*cur = i;
+	schedule_get(&config->schedule, i, config->queue.active, &w);
+	queue_set_active(w.active);
 
-	touchwin(win);
-	wrefresh(no);
-	wrefresh(yes);
+	for (i = 0; i < nas_count(); i++)
+	{
+		nas_limits(i, w.dn, w.up);
+	}
 
-	wbkgd(no, COLOR_PAIR(10));
-	keypad(win, TRUE);
+	nc_notice("Schedule: %s", w.spec);
+}
 
-	ok = 0;
+/*
+ * Fetches lists, collects commands and follows the schedule. Returns the
+ * ms until there is something to do again.
+ */
+static int
+nc_background()
+{
+	struct syno_stats stats;
+	int res, wait, i, n, busy;
 
-	while ((key = wgetch(win)) != 10)
+	n = nas_count();
+
+	nc_schedule(run_config, &sched);
+	busy = cmd_pending() || cmd_uploads();
+
+	/* all commands are through, see what the servers made of them */
+	if (nc_collect_commands())
 	{
-		switch (key)
+		for (i = 0; i < n; i++)
 		{
-		case 0x09: /* TAB */
-			ok = 1 - ok;
-			break;
-		case KEY_LEFT:
-		case 0x68: /* h */
-			ok = 0;
-			break;
-		case KEY_RIGHT:
-		case 0x6c: /* l */
-			ok = 1;
-			break;
-		case 0x59: /* Y */
-		case 0x79: /* y */
-			ok = 1;
-			break;
-		case 0x4e: /* N */
-		case 0x6e: /* n */
-			ok = 0;
-			break;
+			nas_refresh(i, 1);
 		}
+	}
 
-		if (ok)
+	for (i = 0; i < n; i++)
+	{
+		/* with a heartbeat, speed alone is no reason to hurry */
+		if ((res = tasks_refresh(i, &stats)) >= 0)
 		{
-			wbkgd(no, COLOR_PAIR(11));
-			wbkgd(yes, COLOR_PAIR(10));
+			next_refresh[i] = now_ms() + poller_update(&pollers[i],
+				res == 0, !run_config->heartbeat && nas_dn[i] > 0,
+				stats.elapsed * 1000);
 		}
-		else
+
+		if (nc_heartbeat(i))
 		{
-			wbkgd(no, COLOR_PAIR(10));
-			wbkgd(yes, COLOR_PAIR(11));
+			next_refresh[i] = now_ms();
 		}
-		wrefresh(no);
-		wrefresh(yes);
+
+		/* a list fetched now might predate our commands */
+		if (now_ms() >= next_refresh[i] && !cmd_pending() &&
+								!nas_busy(i))
+		{
+			nas_refresh(i, 0);
+
+			/* in case no list comes, e.g. while it is offline */
+			next_refresh[i] = now_ms() + pollers[i].interval;
+		}
+
+		busy |= nas_busy(i);
 	}
 
-	delwin(no);
-	delwin(yes);
-	delwin(win);
+	wait = INT_MAX;
 
-	if (ok)
+	for (i = 0; i < n; i++)
 	{
-		snprintf(buf, sizeof(buf), "%s", nc_selected_task->t->id);
-
-		if (syno_delete(base, s, buf) != 0)
+		if (next_refresh[i] - now_ms() < wait)
 		{
-			nc_alert("Failed to delete task");
-		}
-		else
-		{
-			nc_status("Download task added");
+			wait = next_refresh[i] - now_ms();
 		}
 	}
 
-	touchwin(list);
-	nc_print_tasks();
+	if (run_config->heartbeat && wait > run_config->heartbeat)
+	{
+		wait = run_config->heartbeat;
+	}
+
+	if (run_config->schedule.n && wait > schedule_wait(time(NULL)))
+	{
+		wait = schedule_wait(time(NULL));
+	}
+
+	/* keep an eye on the lists and commands in the background */
+	if (busy && wait > 50)
+	{
+		wait = 50;
+	}
+
+	/* the list of a slow box is coming in */
+	if (busy && nc_activity(NULL, 0))
+	{
+		nc_status_totals(totals_up, totals_dn);
+	}
+
+	return wait > 0 ? wait : 0;
 }
 
 /*
@@ -694,9 +2433,21 @@ nc_delete_task(const char *base, struct session *s)
 void
 init_ui()
 {
+	int fd;
+
 	tasks = NULL;
 	nc_selected_task = NULL;
 
+	/* the threads in the background would scribble all over the screen */
+	fflush(stderr);
+
+	if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+	{
+		saved_stderr = dup(STDERR_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
 	struct sigaction sa;
 	memset(&sa, 0, sizeof(struct sigaction));
 	sa.sa_handler = handle_winch;
@@ -720,6 +2471,8 @@ init_ui()
 	init_pair(10, COLOR_BLACK, COLOR_WHITE);
 	init_pair(11, COLOR_WHITE, COLOR_RED);
 
+	nas_col = nas_count() > 1 ? 9 : 0;
+
 	nc_header();
 	nc_status_bar();
 	nc_task_window();
@@ -734,13 +2487,26 @@ free_ui()
 	delwin(status);
 	delwin(header);
 	endwin();
+
+	if (saved_stderr >= 0)
+	{
+		fflush(stderr);
+		dup2(saved_stderr, STDERR_FILENO);
+		close(saved_stderr);
+		saved_stderr = -1;
+	}
+
+	/* not logged out, the session belongs to the NAS thread */
+	syno_free(session);
+	session = NULL;
 }
 
 void
-ui_add_task(const char *base, struct session *s, const char *task)
+ui_add_task(const char *task)
 {
 	WINDOW *win, *prompt;
-	char str[1024];
+	char str[1024], text[128];
+	const char *err;
 
 	win = newwin(4, COLS - 4, (LINES / 2) - 3, 2);
 	wattron(win, COLOR_PAIR(1));
@@ -777,9 +2543,10 @@ ui_add_task(const char *base, struct session *s, const char *task)
 
 	if (strcmp(str, "") != 0)
 	{
-		if (syno_download(base, s, str) != 0)
+		if ((err = nc_download(str)))
 		{
-			nc_alert("Failed to add task");
+			snprintf(text, sizeof(text), "Failed to add task: %s", err);
+			nc_alert(text);
 		}
 		else
 		{
@@ -791,16 +2558,96 @@ ui_add_task(const char *base, struct session *s, const char *task)
 	nc_print_tasks();
 }
 
+/* Sends what is still pending and stops the background threads */
+static void
+nc_quit()
+{
+	if (cmd_pending())
+	{
+		nc_status("Sending %d command(s)...", cmd_pending());
+	}
+	else
+	{
+		nc_status("Terminating...");
+	}
+
+	/* unlike commands, uploads are not waited for */
+	cmd_cancel();
+	cmd_stop();
+	details_stop();
+	bt_stop();
+	hooks_stop();
+	events_free();
+}
+
 void
-main_loop(const char *base, struct session *s)
+main_loop(struct cfg *config)
 {
-	int key;
+	int key, res, i, n;
+	struct tasklist_ent *prev;
+
+	n = nas_count();
+	run_config = config;
+
+	for (i = 0; i < n; i++)
+	{
+		poller_init(&pollers[i], config->poll_min, config->poll_max);
+		next_refresh[i] = now_ms();
+	}
+
+	queue_init(&config->queue);
+	stall_init(&config->stall);
+	cleanup_init(&config->cleanup);
+
+	if (hooks_start(&config->hooks) != 0)
+	{
+		nc_alert("Failed to start the hooks");
+	}
+	dry_run = config->cleanup.dry_run;
+	sched = -2;
+
+	if (cmd_start() != 0)
+	{
+		nc_alert("Failed to start background commands");
+	}
+
+	if (details_start() != 0)
+	{
+		nc_alert("Failed to start fetching task details");
+	}
 
-	/* TODO remove this */
-	ungetch('r');
+	if (bt_start() != 0)
+	{
+		nc_alert("Failed to start BitTorrent search");
+	}
 
-	while ((key = wgetch(status)) != 27)
+	while (1)
 	{
+		wtimeout(status, nc_background());
+
+		if ((key = wgetch(status)) == 27)
+		{
+			break;
+		}
+
+		if (key == ERR)
+		{
+			continue;
+		}
+
+		/* somebody is watching, refresh sooner */
+		prev = nc_selected_task;
+
+		for (i = 0; i < n; i++)
+		{
+			poller_interact(&pollers[i]);
+
+			if (next_refresh[i] > now_ms() + pollers[i].interval)
+			{
+				next_refresh[i] = now_ms() + pollers[i].interval;
+			}
+		}
+
 		switch (key)
 		{
 		case KEY_UP:
@@ -835,89 +2682,110 @@ main_loop(const char *base, struct session *s)
 		case 0x61:  /* a */
 		case 0x41:  /* A */
 			nc_status("Adding task...");
-			ui_add_task(base, s, "");
+			ui_add_task("");
+			break;
+		case 0x62: /* b */
+		case 0x42: /* B */
+			nc_bt_search();
+			break;
+		case 0x63: /* c */
+		case 0x43: /* C */
+			for (i = 0, res = cmd_cancel(); i < n; i++)
+			{
+				res += nas_cancel(i);
+			}
+
+			if (!res)
+			{
+				nc_notice("Nothing to cancel");
+			}
 			break;
 		case 0x64: /* d */
 		case 0x44:  /* D */
-			nc_status("Deleting task...");
-			nc_delete_task(base, s);
+			nc_delete_task();
 			break;
 		case 0x69: /* i */
 		case 0x49: /* I */
-			nc_task_details(base, s);
+			nc_task_details();
+			break;
+		case 0x6c: /* l */
+		case 0x4c: /* L */
+			nc_upload();
+			break;
+		case 0x70: /* p */
+		case 0x50: /* P */
+			nc_pause_task();
+			break;
+		case 0x20: /* space */
+			nc_mark_task();
+			break;
+		case 0x2b: /* + */
+			nc_queue_move(1);
+			break;
+		case 0x2d: /* - */
+			nc_queue_move(0);
+			break;
+		case 0x76: /* v */
+		case 0x56: /* V */
+			nc_mark_range();
+			break;
+		case 0x75: /* u */
+		case 0x55: /* U */
+			nc_unmark_all();
+			break;
+		case 0x73: /* s */
+		case 0x53: /* S */
+			nc_sort_next();
+			break;
+		case 0x6f: /* o */
+		case 0x4f: /* O */
+			nc_sort_reverse();
+			break;
+		case 0x66: /* f */
+		case 0x46: /* F */
+			nc_filter_next();
+			break;
+		case 0x74: /* t */
+		case 0x54: /* T */
+			nc_filter_text();
+			break;
+		case 0x2f: /* / */
+			nc_search();
+			break;
+		case 0x6e: /* n */
+			nc_search_next(1);
+			break;
+		case 0x4e: /* N */
+			nc_search_next(-1);
 			break;
 		case 0x71: /* q */
 		case 0x51:  /* Q */
-			nc_status("Terminating...");
+			nc_quit();
 			return;
 		case 0x72: /* r */
 		case 0x52:  /* R */
-			nc_status("Refreshing...");
-			tasks_free();
-			if (syno_list(base, s, tasks_add) != 0)
+			if (cmd_pending())
 			{
-				nc_alert("Could not refresh data");
+				nc_status("Waiting for commands to finish...");
+				break;
 			}
-			else
+
+			nc_status("Refreshing...");
+
+			for (i = 0; i < n; i++)
 			{
-				nc_print_tasks();
+				nas_refresh(i, 0);
 			}
 			break;
 		default:
 			break;
 		}
-	}
-}
-
-void
-tasks_free()
-{
-	struct tasklist_ent *ent, *tmp;
-
-	ent = tasks;
-
-	while (ent)
-	{
-		tmp = ent;
-		ent = ent->next;
-
-		free(tmp->t);
-		free(tmp);
-	}
-
-	tasks = NULL;
-}
-
-void
-tasks_add(struct task *t)
-{
-	struct tasklist_ent *ent = malloc(sizeof(struct tasklist_ent));
 
-	if (!ent)
-	{
-		fprintf(stderr, "Malloc failed\n");
-		return;
-	}
-
-	ent->t = malloc(sizeof(struct task));
-
-	if (!ent->t)
-	{
-		fprintf(stderr, "Malloc failed\n");
-		return;
-	}
-
-	memcpy(ent->t, t, sizeof(struct task));
-
-	ent->next = tasks;
-	ent->prev = NULL;
-
-	if (tasks)
-	{
-		tasks->prev = ent;
+		if (nc_selected_task != prev)
+		{
+			nc_prefetch();
+		}
 	}
 
-	tasks = ent;
-
-	nc_selected_task = ent;
+	nc_quit();
 }
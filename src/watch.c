@@ -0,0 +1,642 @@
+/*
+
+SynoDL - CLI for Synology's DownloadStation
+Copyright (C) 2015  Stefan Ott
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "poller.h"
+#include "schedule.h"
+#include "syno.h"
+#include "watch.h"
+
+/*
+ * Files dropped into the watched directory become tasks: .torrent and .nzb
+ * files are uploaded, anything else is read as a list of URLs, one per
+ * line. inotify tells us when a file has been written or moved in; it is
+ * only picked up once nothing has happened to it for a little while, so
+ * that files written in several goes are not sent half-way. Whatever has
+ * settled by then is sent together, and then moved to done/ or failed/.
+ */
+
+/* quiet time before a file counts as complete */
+#define WATCH_SETTLE 2000
+
+/* wait before trying again while the NAS cannot be reached */
+#define WATCH_RETRY 30000
+
+/* files sent in one go */
+#define WATCH_BATCH 32
+
+/* not an error of the NAS, the file could not be read */
+#define UNREADABLE INT_MIN
+
+struct entry
+{
+	char name[NAME_MAX + 1];
+	int64_t due;	/* when to send it, in ms */
+	long sent;	/* bytes of a URL list that have been added already */
+	struct entry *next;
+};
+
+static struct entry *pending;
+static volatile sig_atomic_t stop;
+
+static const char *base;
+static struct session *session;
+static struct schedule_limits saved;
+
+static void
+quit(int sig)
+{
+	stop = 1;
+}
+
+static int
+relogin(struct session *s, void *arg)
+{
+	struct cfg_nas *nas = arg;
+
+	return syno_login(nas->url, s, nas->user, nas->pw);
+}
+
+/* hidden files are what rsync and friends write to before renaming */
+static int
+ignored(const char *name)
+{
+	return name[0] == '.' || !strcmp(name, "done") ||
+							!strcmp(name, "failed");
+}
+
+static int
+is_upload(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	return ext && (!strcasecmp(ext, ".torrent") || !strcasecmp(ext, ".nzb"));
+}
+
+/* (re)starts the quiet time of a file */
+static void
+touch(const char *name)
+{
+	struct entry *e;
+
+	if (ignored(name))
+	{
+		return;
+	}
+
+	for (e = pending; e; e = e->next)
+	{
+		if (!strcmp(e->name, name))
+		{
+			e->due = now_ms() + WATCH_SETTLE;
+			return;
+		}
+	}
+
+	if (!(e = malloc(sizeof(struct entry))))
+	{
+		fprintf(stderr, "Malloc failed\n");
+		return;
+	}
+
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->due = now_ms() + WATCH_SETTLE;
+	e->sent = 0;
+	e->next = pending;
+	pending = e;
+}
+
+/* files that were there before we started */
+static void
+scan(const char *dir)
+{
+	struct dirent *d;
+	struct stat sb;
+	char path[PATH_MAX];
+	DIR *dh;
+
+	if (!(dh = opendir(dir)))
+	{
+		return;
+	}
+
+	while ((d = readdir(dh)))
+	{
+		snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+
+		if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+		{
+			touch(d->d_name);
+		}
+	}
+
+	closedir(dh);
+}
+
+static void
+file_away(const char *dir, const char *name, const char *sub)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	snprintf(from, sizeof(from), "%s/%s", dir, name);
+	snprintf(to, sizeof(to), "%s/%s/%s", dir, sub, name);
+
+	if (rename(from, to) != 0)
+	{
+		fprintf(stderr, "Failed to move %s to %s: %s\n", name, sub,
+							strerror(errno));
+	}
+}
+
+/* a list that was added in part: only the lines after sent go to failed/ */
+static void
+file_rest(const char *dir, const char *name, long sent)
+{
+	char from[PATH_MAX], to[PATH_MAX], buf[4096];
+	FILE *in, *out;
+	size_t n;
+
+	snprintf(from, sizeof(from), "%s/%s", dir, name);
+	snprintf(to, sizeof(to), "%s/failed/%s", dir, name);
+
+	if (!(in = fopen(from, "r")) || fseek(in, sent, SEEK_SET) != 0 ||
+						!(out = fopen(to, "w")))
+	{
+		fprintf(stderr, "Failed to move %s to failed: %s\n", name,
+							strerror(errno));
+
+		if (in)
+		{
+			fclose(in);
+		}
+
+		return;
+	}
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+	{
+		fwrite(buf, 1, n, out);
+	}
+
+	fclose(in);
+
+	if (fclose(out) != 0 || unlink(from) != 0)
+	{
+		fprintf(stderr, "Failed to move %s to failed: %s\n", name,
+							strerror(errno));
+	}
+}
+
+static int
+create(const char *uris)
+{
+	if (syno_download(base, session, uris) == 0)
+	{
+		return 0;
+	}
+
+	/* e.g. a URL that is too long on its own */
+	return syno_error(session) ? syno_error(session) : 100;
+}
+
+/*
+ * Adds the URLs listed in a file, as many at a time as fit into a request.
+ * Returns 0 on success, else the error of the request that failed. sent
+ * keeps track of the lines added so far, so that a retry skips them.
+ */
+static int
+send_list(const char *path, long *sent)
+{
+	char line[SYNO_URL_MAX], uris[SYNO_URL_MAX], *p;
+	struct stat sb;
+	long start;
+	int len, res, size;
+	FILE *fh;
+
+	if (!(fh = fopen(path, "r")))
+	{
+		return UNREADABLE;
+	}
+
+	/* written anew since the last try, it is a different list now */
+	if (fstat(fileno(fh), &sb) != 0 || sb.st_size < *sent)
+	{
+		*sent = 0;
+	}
+
+	if (fseek(fh, *sent, SEEK_SET) != 0)
+	{
+		fclose(fh);
+		return UNREADABLE;
+	}
+
+	res = 0;
+	len = 0;
+	uris[0] = 0;
+
+	while (res == 0 && (start = ftell(fh)) >= 0 &&
+					fgets(line, sizeof(line), fh))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+
+		if (*p == 0 || *p == '#')
+		{
+			continue;
+		}
+
+		/* try with this one added, send what we have if it does not fit */
+		snprintf(uris + len, sizeof(uris) - len, "%s%s", len ? "," : "", p);
+
+		size = syno_create_url(NULL, 0, base, session, uris);
+
+		if (len > 0 && (size < 0 || size >= SYNO_URL_MAX))
+		{
+			uris[len] = 0;
+
+			/* everything before this line is on the NAS now */
+			if ((res = create(uris)) == 0)
+			{
+				*sent = start;
+			}
+
+			snprintf(uris, sizeof(uris), "%s", p);
+		}
+
+		len = strlen(uris);
+	}
+
+	if (res == 0 && len > 0 && (res = create(uris)) == 0)
+	{
+		*sent = ftell(fh);
+	}
+
+	fclose(fh);
+	return res;
+}
+
+static void
+report(const char *dir, struct entry *e, int res)
+{
+	if (res == 0)
+	{
+		printf("Added %s\n", e->name);
+		file_away(dir, e->name, "done");
+	}
+	else if (res < 0 && res != UNREADABLE)
+	{
+		/* the NAS is unreachable, the file is fine */
+		fprintf(stderr, "Failed to add %s, will try again: %s\n",
+						e->name, syno_strerror(res));
+		e->due = now_ms() + WATCH_RETRY;
+		return;
+	}
+	else
+	{
+		fprintf(stderr, "Failed to add %s: %s\n", e->name,
+			res == UNREADABLE ? "Cannot read file" : syno_strerror(res));
+
+		if (e->sent > 0)
+			file_rest(dir, e->name, e->sent);
+		else
+			file_away(dir, e->name, "failed");
+	}
+
+	e->due = -1;
+}
+
+/* sends the files that have settled, leaves those to be retried */
+static void
+flush(const char *dir, struct cfg_nas *nas)
+{
+	struct entry *batch[WATCH_BATCH], **p, *e;
+	char *paths[WATCH_BATCH], path[PATH_MAX];
+	int res[WATCH_BATCH], up[WATCH_BATCH], slot[WATCH_BATCH];
+	int i, n, uploads;
+	int64_t now;
+	struct stat sb;
+
+	now = now_ms();
+	n = 0;
+
+	for (e = pending; e && n < WATCH_BATCH; e = e->next)
+	{
+		if (e->due <= now)
+		{
+			batch[n++] = e;
+		}
+	}
+
+	if (n == 0)
+	{
+		return;
+	}
+
+	if (!strcmp(syno_sid(session), "") && syno_login(base, session,
+						nas->user, nas->pw) != 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			batch[i]->due = now + WATCH_RETRY;
+		}
+		return;
+	}
+
+	/* the uploads go first, all together */
+	uploads = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		res[i] = UNREADABLE;
+		slot[i] = -1;
+
+		if (!is_upload(batch[i]->name))
+		{
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", dir, batch[i]->name);
+
+		if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+				!(paths[uploads] = strdup(path)))
+		{
+			continue;
+		}
+
+		slot[i] = uploads++;
+	}
+
+	if (uploads > 0)
+	{
+		syno_upload(base, session, paths, uploads, up);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (slot[i] >= 0)
+		{
+			res[i] = up[slot[i]];
+		}
+		else if (!is_upload(batch[i]->name))
+		{
+			snprintf(path, sizeof(path), "%s/%s", dir, batch[i]->name);
+			res[i] = send_list(path, &batch[i]->sent);
+		}
+
+		report(dir, batch[i], res[i]);
+	}
+
+	for (i = 0; i < uploads; i++)
+	{
+		free(paths[i]);
+	}
+
+	fflush(stdout);
+
+	p = &pending;
+
+	while ((e = *p))
+	{
+		if (e->due < 0)
+		{
+			*p = e->next;
+			free(e);
+		}
+		else
+		{
+			p = &e->next;
+		}
+	}
+}
+
+/* ms until the next file is due, -1 if there are none */
+static int
+next_due()
+{
+	struct entry *e;
+	int64_t due, now;
+
+	due = -1;
+
+	for (e = pending; e; e = e->next)
+	{
+		if (due < 0 || e->due < due)
+		{
+			due = e->due;
+		}
+	}
+
+	if (due < 0)
+	{
+		return -1;
+	}
+
+	now = now_ms();
+	return due > now ? due - now : 0;
+}
+
+/* sets the speed limits of the schedule window that has begun, if any */
+static void
+apply_schedule(struct cfg *config, int *cur)
+{
+	struct schedule_window w;
+	int i;
+
+	if ((i = schedule_find(&config->schedule, time(NULL))) == *cur)
+	{
+		return;
+	}
+
+	schedule_get(&config->schedule, i, config->queue.active, &w);
+
+	if (schedule_limits(&saved, base, session, w.dn, w.up) != 0)
+	{
+		fprintf(stderr, "Failed to set the speed limits: %s\n",
+					syno_strerror(syno_error(session)));
+
+		/* try again in a minute, unless it was refused */
+		if (syno_error(session) < 0)
+		{
+			return;
+		}
+	}
+
+	printf("Schedule: %s\n", w.spec);
+	fflush(stdout);
+	*cur = i;
+}
+
+static int
+make_dir(const char *dir, const char *sub)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, sub);
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* adds files dropped into dir as tasks on the first NAS, until killed */
+int
+watch_dir(struct cfg *config, const char *dir)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct sigaction sa;
+	struct pollfd pfd;
+	struct entry *e;
+	ssize_t len;
+	char *p;
+	int fd, wait, sched;
+
+	if (make_dir(dir, "done") != 0 || make_dir(dir, "failed") != 0)
+	{
+		return 1;
+	}
+
+	if ((fd = inotify_init1(IN_CLOEXEC)) < 0)
+	{
+		fprintf(stderr, "inotify_init1 failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+						IN_MODIFY | IN_ONLYDIR) < 0)
+	{
+		fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = quit;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* one session for as long as we run, renewed when it expires */
+	base = config->nas[0].url;
+
+	if (!(session = config_session(config)))
+	{
+		close(fd);
+		return 1;
+	}
+
+	syno_set_relogin(session, relogin, &config->nas[0]);
+	syno_login(base, session, config->nas[0].user, config->nas[0].pw);
+
+	printf("Watching %s\n", dir);
+	fflush(stdout);
+
+	/* watching since before, so no file slips through between the two */
+	scan(dir);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	sched = -2;
+
+	while (!stop)
+	{
+		wait = next_due();
+
+		/* the speed limits follow the schedule, there is no queue */
+		if (config->schedule.n)
+		{
+			apply_schedule(config, &sched);
+
+			if (wait < 0 || wait > schedule_wait(time(NULL)))
+			{
+				wait = schedule_wait(time(NULL));
+			}
+		}
+
+		if (poll(&pfd, 1, wait) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		if (pfd.revents & POLLIN)
+		{
+			if ((len = read(fd, buf, sizeof(buf))) <= 0)
+			{
+				continue;
+			}
+
+			for (p = buf; p < buf + len;
+				p += sizeof(struct inotify_event) + ev->len)
+			{
+				ev = (const struct inotify_event *) p;
+
+				if (ev->len > 0 && !(ev->mask & IN_ISDIR))
+				{
+					touch(ev->name);
+				}
+			}
+		}
+
+		flush(dir, &config->nas[0]);
+	}
+
+	while ((e = pending))
+	{
+		pending = e->next;
+		free(e);
+	}
+
+	close(fd);
+
+	if (strcmp(syno_sid(session), ""))
+	{
+		/* what a schedule window changed goes back as it was */
+		schedule_limits(&saved, base, session, -1, -1);
+		syno_logout(base, session);
+	}
+
+	syno_free(session);
+	return 0;
+}